@@ -0,0 +1,284 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "error.h"
+#include "file.h"
+#include "probe.h"
+
+#ifndef SYS_cachestat
+#define SYS_cachestat   451     /* Linux 6.5, the same on all arches */
+#endif
+
+namespace NProbe {
+
+    /* Page counters of a file range, cachestat() gives all of them,
+        mincore() is able to tell only about the cached pages.      */
+
+    struct TUsage {
+        TUsage& operator +=(const TUsage &rval) noexcept
+        {
+            Cached      += rval.Cached;
+            Dirty       += rval.Dirty;
+            Writeback   += rval.Writeback;
+            Evicted     += rval.Evicted;
+            Recent      += rval.Recent;
+
+            return *this;
+        }
+
+        uint64_t    Cached      = 0;
+        uint64_t    Dirty       = 0;
+        uint64_t    Writeback   = 0;
+        uint64_t    Evicted     = 0;
+        uint64_t    Recent      = 0;
+    };
+
+    enum EKind {
+        KIND_AUTO       = 0,
+        KIND_MINCORE    = 1,
+        KIND_CACHESTAT  = 2,
+    };
+
+    class IBackend {
+    public:
+        virtual ~IBackend() { }
+
+        /* Has dirty, writeback and eviction counters in TUsage */
+        virtual bool Extended() const noexcept = 0;
+
+        virtual TUsage Count(const NOs::TFile&, const NUtils::TSpan&) = 0;
+
+        /* Counts cached pages in the ascending list of page numbers */
+        virtual size_t Hits(const NOs::TFile&, const size_t *pages, size_t num) = 0;
+    };
+
+    class TMinCore : public IBackend {
+    public:
+        TMinCore(size_t window_ = TProbe::Window)
+            : window(window_), probe(window_) { }
+
+        bool Extended() const noexcept override { return false; }
+
+        TUsage Count(const NOs::TFile &file, const NUtils::TSpan &span) override
+        {
+            TUsage usage;
+
+            const size_t gran = getpagesize();
+
+            probe(file, span, [&](NUtils::TSpan &run) {
+                usage.Cached += run.bytes / gran;
+            });
+
+            return usage;
+        }
+
+        size_t Hits(const NOs::TFile &file, const size_t *pages, size_t num) override
+        {
+            const size_t gran = getpagesize();
+            const size_t span = NMisc::DivUp(std::max(window, gran), gran);
+            const size_t last = NMisc::DivUp(NOs::TStat(file).Bytes, gran);
+
+            size_t hits = 0;
+
+            for (size_t z = 0; z < num;) {
+                const size_t at = (pages[z] / span) * span;
+                const size_t end = std::min(at + span, last);
+
+                if (pages[z] >= end) break;
+
+                NOs::TMapped map(file, NUtils::TSpan(at * gran, (end - at) * gran));
+
+                for (; z < num && pages[z] < end; z++) {
+                    unsigned char vec = 0;
+
+                    char *ptr = (char*)*map + (pages[z] - at) * gran;
+
+                    if (mincore(ptr, gran, &vec) < 0)
+                        throw TError("error happens while mincore() invocation");
+
+                    hits += vec & 0x01;
+                }
+            }
+
+            return hits;
+        }
+
+    protected:
+        size_t      window;
+        TProbe      probe;
+    };
+
+    class TCacheStat : public IBackend {
+    public:
+        struct TRange {
+            uint64_t    Off;
+            uint64_t    Len;
+        };
+
+        struct TStat {
+            uint64_t    Cache;
+            uint64_t    Dirty;
+            uint64_t    Writeback;
+            uint64_t    Evicted;
+            uint64_t    Recently;
+        };
+
+        static constexpr long Call = SYS_cachestat;
+
+        /* With the fallback files refused by cachestat(), for example
+            by EOPNOTSUPP of some filesystems, are probed by mincore() */
+
+        TCacheStat(bool fallback = false, size_t window = TProbe::Window)
+        {
+            if (fallback) mincore.reset(new TMinCore(window));
+        }
+
+        static bool Supported() noexcept
+        {
+            TRange range = { 0, 0 };
+            TStat  stat;
+
+            /* invalid fd gives EBADF when the call is known to kernel */
+
+            return ::syscall(Call, -1, &range, &stat, 0) < 0 && errno == EBADF;
+        }
+
+        bool Extended() const noexcept override { return true; }
+
+        /* Counts only data extents as mincore() probe does, pages cached
+            over holes of sparse files are not reported by any backend */
+
+        TUsage Count(const NOs::TFile &file, const NUtils::TSpan &span) override
+        {
+            try {
+                return Extents(file, span);
+            } catch (TError &error) {
+                if (!mincore) throw;
+
+                return mincore->Count(file, span);
+            }
+        }
+
+        size_t Hits(const NOs::TFile &file, const size_t *pages, size_t num) override
+        {
+            try {
+                return Pages(file, pages, num);
+            } catch (TError &error) {
+                if (!mincore) throw;
+
+                return mincore->Hits(file, pages, num);
+            }
+        }
+
+    protected:
+        TUsage Extents(const NOs::TFile &file, const NUtils::TSpan &span)
+        {
+            const size_t gran = getpagesize();
+
+            TUsage usage;
+
+            size_t done = 0;
+
+            NOs::Extents(file, span, [&](const NUtils::TSpan &data) {
+                const size_t at = std::max(NMisc::GranDown(data.at, gran), done);
+
+                if (at < data.after()) {
+                    usage += Stat(file, NUtils::TSpan(at, data.after() - at));
+
+                    done = NMisc::GranUp(data.after(), gran);
+                }
+            });
+
+            return usage;
+        }
+
+        size_t Pages(const NOs::TFile &file, const size_t *pages, size_t num)
+        {
+            const size_t gran = getpagesize();
+
+            size_t hits = 0;
+
+            for (size_t z = 0; z < num; z++) {
+                const NUtils::TSpan span(pages[z] * gran, gran);
+
+                hits += Stat(file, span).Cached > 0;
+            }
+
+            return hits;
+        }
+
+        TUsage Stat(const NOs::TFile &file, const NUtils::TSpan &span)
+        {
+            TUsage usage;
+
+            if (span) {
+                TRange range = { span.at, span.bytes };
+                TStat  stat;
+
+                if (::syscall(Call, (int)file, &range, &stat, 0) < 0)
+                    throw TError("error happens while cachestat() invocation");
+
+                usage.Cached    = stat.Cache;
+                usage.Dirty     = stat.Dirty;
+                usage.Writeback = stat.Writeback;
+                usage.Evicted   = stat.Evicted;
+                usage.Recent    = stat.Recently;
+            }
+
+            return usage;
+        }
+
+        std::unique_ptr<TMinCore> mincore;  /* fallback under auto  */
+    };
+
+    using TBackend = std::unique_ptr<IBackend>;
+
+    inline EKind Resolve(EKind kind) noexcept
+    {
+        if (kind == KIND_AUTO) {
+            return TCacheStat::Supported() ? KIND_CACHESTAT : KIND_MINCORE;
+        } else {
+            return kind;
+        }
+    }
+
+    inline TBackend Make(EKind kind, size_t window = TProbe::Window)
+    {
+        const bool fallback = kind == KIND_AUTO;
+
+        kind = Resolve(kind);
+
+        if (kind == KIND_CACHESTAT) {
+            if (!TCacheStat::Supported())
+                throw TError("cachestat() is not supported by kernel");
+
+            return TBackend(new TCacheStat(fallback, window));
+        } else {
+            return TBackend(new TMinCore(window));
+        }
+    }
+
+    inline bool Parse(const std::string &name, EKind &kind) noexcept
+    {
+        if (name == "auto") {
+            kind = KIND_AUTO;
+        } else if (name == "mincore") {
+            kind = KIND_MINCORE;
+        } else if (name == "cachestat") {
+            kind = KIND_CACHESTAT;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+}
@@ -4,13 +4,15 @@
 
 #include <cassert>
 #include <vector>
+#include <algorithm>
+#include "misc.h"
 #include "parts.h"
 
 namespace NStats {
 
     struct TBand {
         TBand(size_t at_, size_t limit_)
-                : At(at_), Limit(limit_) { }
+                : At(at_), Limit(limit_), Alloc(limit_) { }
 
         bool operator ==(size_t offset) const noexcept {
             return offset >= At && offset < After();
@@ -20,6 +22,8 @@ namespace NStats {
 
         bool Full() const noexcept { return Value >= Limit; }
 
+        bool Hole() const noexcept { return Alloc == 0 && Limit > 0; }
+
         size_t After() const noexcept { return At + Limit; }
 
         double Usage() const noexcept {
@@ -42,24 +46,100 @@ namespace NStats {
         size_t At = 0;
         size_t Limit = 0;
         size_t Value = 0;
+        size_t Alloc = 0;   /* bytes of data extents, not holes */
     };
 
+    /* Bands are kept as the structure of arrays: all of them but the
+        last one have the same Step bytes, thus only usage values are
+        stored and the band of an offset is found by the division   */
+
     class TBands {
     public:
-        using TVec = std::vector<TBand>;
-
-        TBands(size_t size, size_t slots) : All(0, size)
+        TBands(size_t size, size_t step_)
+            : All(0, size), Step(std::max(step_, size_t(1)))
         {
-            Bands.reserve(slots);
+            Values.assign(NMisc::DivUp(size, Step), 0);
         }
 
-        operator const TVec&() const noexcept { return Bands; }
-
         operator const TBand&() const noexcept { return All; }
 
         double Raito() const noexcept { return All.Usage(); }
 
-        size_t Size() const noexcept { return Bands.size(); }
+        size_t Size() const noexcept { return Values.size(); }
+
+        size_t Gran() const noexcept { return Step; }
+
+        const size_t* Data() const noexcept { return Values.data(); }
+
+        size_t Value(size_t z) const noexcept { return Values[z]; }
+
+        TBand Band(size_t z) const noexcept { return Sum(z, z + 1); }
+
+        /* Aggregated band of the bands range [from, to) */
+
+        TBand Sum(size_t from, size_t to) const noexcept
+        {
+            const size_t at = from * Step;
+
+            TBand band(at, std::min(to * Step, All.Limit) - at);
+
+            for (size_t z = from; z < to; z++) band.Value += Values[z];
+
+            if (!Allocs.empty()) {
+                band.Alloc = 0;
+
+                for (size_t z = from; z < to; z++) band.Alloc += Allocs[z];
+            }
+
+            return band;
+        }
+
+        /* Sets usage of each band by a counter for its whole range, it
+            is the way to populate bands without spans, by cachestat() */
+
+        template<typename TCount> void Fill(TCount &&count)
+        {
+            All.Value = 0;
+
+            for (size_t z = 0; z < Values.size(); z++) {
+                const TBand band = Band(z);
+
+                Values[z] = std::min(band.Limit, size_t(count(band)));
+
+                All.Value += Values[z];
+            }
+        }
+
+        /* Clears usage of all bands, the layout is kept for reuse */
+
+        void Reset() noexcept
+        {
+            All.Value = 0;
+
+            std::fill(Values.begin(), Values.end(), 0);
+        }
+
+        /* Allocated bytes of bands by data extents of the file, rounded
+            to pages. Bands without any of them are holes. Until the
+            first call all of the bands are treated as allocated.     */
+
+        void Allocate(const std::vector<NUtils::TSpan> &extents, size_t page)
+        {
+            Allocs.assign(Values.size(), 0);
+
+            size_t done = 0;
+
+            for (auto &data : extents) {
+                const size_t at = std::max(NMisc::GranDown(data.at, page), done);
+                const size_t end = std::min(NMisc::GranUp(data.after(), page), All.Limit);
+
+                if (at < end) Spread(Allocs, at, end), done = end;
+            }
+
+            All.Alloc = 0;
+
+            for (auto bytes : Allocs) All.Alloc += bytes;
+        }
 
     protected:
         void Accum(NUtils::TSpan span) noexcept
@@ -69,49 +149,62 @@ namespace NStats {
             assert(!span);
         }
 
-        TBand All;
-        TVec  Bands;
+        /* Adds bytes of [at, end) to bands, whole bands inside of it
+            are simply filled up in a loop which is vectorized      */
+
+        void Spread(std::vector<size_t> &to, size_t at, const size_t end) noexcept
+        {
+            size_t z = at / Step;
+
+            const size_t head = std::min(end, (z + 1) * Step) - at;
+
+            to[z++] += head, at += head;
+
+            for (; at + Step <= end; at += Step) to[z++] += Step;
+
+            if (at < end) to[z] += end - at;
+        }
+
+        TBand               All;
+        size_t              Step    = 1;
+        std::vector<size_t> Values;
+        std::vector<size_t> Allocs; /* empty while not allocated    */
     };
 
+    /* Algo has to give parts of equal size but the last one, Tailed */
+
     template<template<typename Fwd> class  Algo>
     class TParted : public TBands {
     public:
         using Ref = std::unique_ptr<TParted<Algo>>;
         using TIter = NParts::TRange::const_iterator;
 
-        TParted(size_t size, size_t slots) : TBands(size, slots)
+        TParted(size_t size, size_t slots) : TBands(size, Limit(size, slots))
         {
-            using namespace NParts;
-
-            auto make = [&](size_t z, TIter &at, TIter &end) {
-                Bands.emplace_back(at, end - at);
-            };
 
-            Limit = Algo<TRange>(TRange(0, size), slots)(make);
-
-            assert(size == Bands.back().After());
         }
 
+        /* Span is spread over bands by offsets, without any search */
+
         void operator()(NUtils::TSpan &span) noexcept
         {
             if (span) {
                 Accum(span);
 
-                auto it = Bands.begin() + (span.at / Limit);
+                Spread(Values, span.at, span.after());
 
-                assert(it->At <= span.at);
-
-                it = std::find(it, Bands.end(), span.at);
-
-                for (; span && it != Bands.end(); it++) {
-                    it->Inc(span);
-                }
+                span.advance(span.bytes);
             }
 
             assert(!span);
         }
 
     protected:
-        size_t Limit = 0;
+        static size_t Limit(size_t size, size_t slots)
+        {
+            using namespace NParts;
+
+            return Algo<TRange>(TRange(0, size), slots)([](size_t, TIter&, TIter&) { });
+        }
     };
 }
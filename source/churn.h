@@ -0,0 +1,128 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+#include "decay.h"
+#include "humans.h"
+#include "parts.h"
+
+namespace NStats {
+
+    /* Page-in and page-out rates of bands between successive probes,
+        bytes per second decayed over a few ticks. Changes are taken on
+        the fine bands and then summed into the printed slots, thus a
+        page moved within a single fine band is not visible as churn */
+
+    class TChurn {
+    public:
+        using TIter = NParts::TRange::const_iterator;
+        using TSecs = std::chrono::duration<double>;
+        using TPass = NDecay::TCfg<TSecs>;
+
+        TChurn(size_t slots_, TPass decay_) : slots(slots_), decay(decay_) { }
+
+        void operator()(const TBands &bands, TSecs secs)
+        {
+            const size_t *values = bands.Data();
+
+            if (prev.size() != bands.Size()) {
+                /* layout of bands is changed with the file size */
+
+                prev.assign(values, values + bands.Size()), ins.assign(slots, { });
+                outs.assign(slots, { });
+                in = out = NDecay::TValue();
+
+                edges.clear();
+
+                const NParts::TRange range(bands.Size());
+
+                NParts::Equal<NParts::TRange>(range, slots)(
+                    [&](size_t, TIter at, TIter) { edges.push_back(at); });
+
+                edges.push_back(bands.Size());
+
+                return;
+            }
+
+            const bool some = secs.count() > 0;
+            const double pass = some ? decay(secs) : 1;
+            const double rate = some ? 1. / secs.count() : 0;
+
+            size_t got = 0, lost = 0;
+
+            /* slots edges are cached, std::function of NParts allocates */
+
+            for (size_t z = 0; z + 1 < edges.size(); z++) {
+                size_t up = 0, down = 0;
+
+                for (size_t y = edges[z]; y < edges[z + 1]; y++) {
+                    const size_t value = values[y];
+
+                    if (value > prev[y]) {
+                        up += value - prev[y];
+                    } else {
+                        down += prev[y] - value;
+                    }
+
+                    prev[y] = value;
+                }
+
+                ins[z](pass, up * rate), outs[z](pass, down * rate);
+
+                got += up, lost += down;
+            }
+
+            in(pass, got * rate), out(pass, lost * rate);
+        }
+
+        std::ostream& operator()(std::ostream &os, const TBands &bands) const noexcept
+        {
+            os
+                << "[" << Syms(bands) << "] in "
+                << NHumans::Value(std::max(ssize_t(in), ssize_t(0))) << "/s out "
+                << NHumans::Value(std::max(ssize_t(out), ssize_t(0))) << "/s";
+
+            return os;
+        }
+
+        /* Page-in is shown by i, page-out by o, both of them by x, the
+            capital letter is used when the rate is over 1/10 of slot */
+
+        std::string Syms(const TBands &bands) const noexcept
+        {
+            std::string syms(slots, ' ');
+
+            if (ins.size() != slots || edges.back() != bands.Size()) return syms;
+
+            for (size_t z = 0; z + 1 < edges.size(); z++) {
+                const size_t limit = bands.Sum(edges[z], edges[z + 1]).Limit;
+
+                const double up = ssize_t(ins[z]), down = ssize_t(outs[z]);
+
+                if (up < 1 && down < 1) continue;
+
+                const char *set = up > 2 * down ? "iI" : down > 2 * up ? "oO" : "xX";
+
+                syms[z] = set[(up + down) * 10 > limit];
+            }
+
+            return syms;
+        }
+
+    protected:
+        size_t                      slots = 0;
+        TPass                       decay{ TSecs(1) };
+        std::vector<size_t>         prev;
+        std::vector<size_t>         edges;  /* first band of slots  */
+        std::vector<NDecay::TValue> ins;
+        std::vector<NDecay::TValue> outs;
+        NDecay::TValue              in;
+        NDecay::TValue              out;
+    };
+}
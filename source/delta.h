@@ -0,0 +1,190 @@
+#pragma once /*__ GPL 3.0, 2020 Alexander Soloviev (no.friday@yandex.ru) */
+
+#include <unistd.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "snap.h"
+#include "humans.h"
+
+class TMod_Diff {
+
+    struct TCfg {
+        bool Verbose = false;   /* Print changed ranges of files    */
+        bool Zeroes = false;    /* Print files without any changes  */
+    };
+
+    using TRun = NSnap::TRun;
+    using TVec = std::vector<TRun>;
+
+public:
+    int Handle(int argc, char *argv[])
+    {
+        extern char *optarg;
+
+        std::string one, two;
+        TCfg cfg{ };
+
+        while (true) {
+            static const char opts[] = "a:b:vz";
+
+            const int opt = getopt(argc, argv, opts);
+
+            if (opt < 0) break;
+
+            if (opt == 'a') {
+                one = optarg;
+            } else if (opt == 'b') {
+                two = optarg;
+            } else if (opt == 'v') {
+                cfg.Verbose = true;
+            } else if (opt == 'z') {
+                cfg.Zeroes = true;
+            }
+        }
+
+        if (one.empty() || two.empty()) {
+            std::cerr << "both snapshots -a and -b have to be given\n";
+
+            return 1;
+        }
+
+        return Run(one, two, cfg);
+    }
+
+    int Run(const std::string &one, const std::string &two, const TCfg &cfg)
+    {
+        const NSnap::TReader was(one), now(two);
+
+        if (was.Head().Page != now.Head().Page) {
+            std::cerr << "snapshots are taken with different page size\n";
+
+            return 2;
+        }
+
+        page = now.Head().Page;
+
+        /* Both snapshots are streamed in order of paths and merged,
+            a path found only in the older one is of a gone file   */
+
+        NSnap::TCursor older(was), newer(now);
+        NSnap::TItem old, item;
+
+        bool left = older.next(old), right = newer.next(item);
+
+        while (left || right) {
+            const int cmp = !left ? 1 : !right ? -1 : old.Path.compare(item.Path);
+
+            if (cmp < 0) {
+                Report(&old, nullptr, cfg);
+            } else if (cmp > 0) {
+                Report(nullptr, &item, cfg);
+            } else if (old.Rec->Dev != item.Rec->Dev || old.Rec->Ino != item.Rec->Ino) {
+                Report(&old, nullptr, cfg);
+                Report(nullptr, &item, cfg);
+            } else {
+                Report(&old, &item, cfg);
+            }
+
+            if (cmp <= 0) left = older.next(old);
+            if (cmp >= 0) right = newer.next(item);
+        }
+
+        Print(total.first, total.second, ":summary");
+
+        return 0;
+    }
+
+protected:
+    void Report(const NSnap::TItem *was, const NSnap::TItem *now, const TCfg &cfg)
+    {
+        Decode(was, one);
+        Decode(now, two);
+
+        ranges.clear();
+
+        size_t in = 0, out = 0;
+
+        Minus(two, one, [&](uint64_t at, uint64_t pages) {
+            in += pages;
+
+            if (cfg.Verbose) ranges.push_back({ '+', { at, pages } });
+        });
+
+        Minus(one, two, [&](uint64_t at, uint64_t pages) {
+            out += pages;
+
+            if (cfg.Verbose) ranges.push_back({ '-', { at, pages } });
+        });
+
+        total.first += in * page, total.second += out * page;
+
+        if (in + out > 0 || cfg.Zeroes) {
+            std::string_view path = (now ? now : was)->Path;
+
+            Print(in * page, out * page, path);
+
+            for (auto &range : ranges) {
+                std::cout
+                    << "    " << range.first << " "
+                    << range.second.At * page << " "
+                    << range.second.Pages * page << "\n";
+            }
+        }
+    }
+
+    void Print(size_t in, size_t out, std::string_view path)
+    {
+        std::cout
+            << std::setw(5) << NHumans::Value(in)
+            << " in "
+            << std::setw(5) << NHumans::Value(out)
+            << " out "
+            << path
+            << "\n";
+    }
+
+    static void Decode(const NSnap::TItem *item, TVec &vec)
+    {
+        vec.clear();
+
+        if (item) {
+            for (auto runs = item->Runs(); runs;) vec.push_back(runs.next());
+        }
+    }
+
+    /* Calls func for each range of pages in one which are not in two */
+
+    template<typename TFunc>
+    static void Minus(const TVec &one, const TVec &two, TFunc &&func)
+    {
+        size_t near = 0;
+
+        for (const auto &run : one) {
+            uint64_t at = run.At;
+
+            while (near < two.size() && two[near].After() <= at) near++;
+
+            for (size_t z = near; at < run.After(); z++) {
+                if (z >= two.size() || two[z].At >= run.After()) {
+                    func(at, run.After() - at);
+
+                    break;
+                } else if (two[z].At > at) {
+                    func(at, two[z].At - at);
+                }
+
+                at = std::max(at, two[z].After());
+            }
+        }
+    }
+
+    size_t                  page = 0;
+    std::pair<size_t, size_t> total{ 0, 0 };
+    TVec                    one;
+    TVec                    two;
+    std::vector<std::pair<char, TRun>> ranges;
+};
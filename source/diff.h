@@ -3,31 +3,120 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#ifndef FINCORE_X86
+#define FINCORE_X86 1
+#endif
+#endif
 
 #include "misc.h"
 #include "bands.h"
 
 namespace NStats {
 
-    struct TDiff {
-        using TVec = TBands::TVec;
+    /* Sum of absolute differences of two usage vectors, values of
+        bands are file offsets, thus below 2^63 and the signed compare
+        is enough. The vectorized variant is selected once at runtime */
+
+    using TDist = uint64_t (*)(const size_t *one, const size_t *two, size_t items);
+
+    inline uint64_t Dist_Plain(const size_t *one, const size_t *two, size_t items)
+    {
+        uint64_t accum = 0;
+
+        for (size_t z = 0; z < items; z++) {
+            accum += one[z] > two[z] ? one[z] - two[z] : two[z] - one[z];
+        }
+
+        return accum;
+    }
+
+#ifdef FINCORE_X86
+
+    __attribute__((target("avx2")))
+    inline uint64_t Dist_AVX2(const size_t *one, const size_t *two, size_t items)
+    {
+        __m256i accum = _mm256_setzero_si256();
+
+        size_t z = 0;
+
+        for (; z + 4 <= items; z += 4) {
+            const auto a = _mm256_loadu_si256((const __m256i*)(one + z));
+            const auto b = _mm256_loadu_si256((const __m256i*)(two + z));
+
+            const auto more = _mm256_cmpgt_epi64(a, b);
+
+            const auto diff = _mm256_blendv_epi8(
+                    _mm256_sub_epi64(b, a), _mm256_sub_epi64(a, b), more);
+
+            accum = _mm256_add_epi64(accum, diff);
+        }
 
+        uint64_t lanes[4];
+
+        _mm256_storeu_si256((__m256i*)lanes, accum);
+
+        return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+                + Dist_Plain(one + z, two + z, items - z);
+    }
+
+#endif
+
+    inline TDist SelectDist() noexcept
+    {
+#ifdef FINCORE_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2")) return Dist_AVX2;
+#endif
+        return Dist_Plain;
+    }
+
+    inline uint64_t Dist(const size_t *one, const size_t *two, size_t items)
+    {
+        static const TDist impl = SelectDist();
+
+        return impl(one, two, items);
+    }
+
+    struct TDiff {
         double operator()(const TBands &one, const TBands &two) const noexcept
         {
             return std::max(Diff(one, two), Spacial(one, two));
         }
 
-        double Spacial(const TVec &one, const TVec &two) const noexcept
+        /* Bands of the same layout have equal limits but the last one,
+            thus the sum of relative differences is the single division
+            of the whole distance, without a division for each band */
+
+        double Spacial(const TBands &one, const TBands &two) const noexcept
         {
-            assert(one.size() == two.size());
+            assert(one.Size() == two.Size());
+
+            const size_t items = one.Size();
+
+            if (items == 0) return 0;
 
-            double accum = 0;
+            const TBand &all = one, &other = two;
 
-            for (size_t z = 0; z < one.size(); z++) {
-                accum += TDiff::Diff(one[z], two[z]);
+            if (one.Gran() != two.Gran() || all.Limit != other.Limit) {
+                double accum = 0;
+
+                for (size_t z = 0; z < items; z++) {
+                    accum += TDiff::Diff(one.Band(z), two.Band(z));
+                }
+
+                return accum;
             }
 
-            return accum;
+            const size_t last = items - 1;
+
+            return double(Dist(one.Data(), two.Data(), last)) / one.Gran()
+                    + TDiff::Diff(one.Band(last), two.Band(last));
         }
 
         static double Diff(const TBand &one, const TBand &two) noexcept
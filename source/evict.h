@@ -0,0 +1,171 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <fcntl.h>
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <condition_variable>
+
+#include "walk.h"
+#include "pool.h"
+#include "backend.h"
+#include "humans.h"
+
+class TEvict {
+public:
+    struct TCfg {
+        unsigned    threads = 0;    /* zero for serial evicting     */
+        size_t      target  = 0;    /* bytes to free, zero for all  */
+        bool        verbose = false;
+        NProbe::EKind backend = NProbe::KIND_AUTO;
+    };
+
+    TEvict(const TCfg &cfg_) : cfg(cfg_) { }
+
+    void Do(const std::string &path)
+    {
+        if (NOs::TStat(path).Type == NOs::ENode::Dir) {
+            NUtils::NDir::TWalk walk(path);
+
+            Do(walk);
+        } else {
+            NUtils::NDir::TOne one(path);
+
+            Do(one);
+        }
+    }
+
+    void Do(std::istream &in, char delim = '\n')
+    {
+        NUtils::NDir::TList list(in, delim);
+
+        Do(list);
+    }
+
+protected:
+    void Do(NUtils::NDir::IEnum &walk)
+    {
+        std::vector<NProbe::TBackend> probes;
+
+        for (size_t z = 0; z < std::max(cfg.threads, 1u); z++)
+            probes.emplace_back(NProbe::Make(cfg.backend));
+
+        std::unique_ptr<NUtils::TPool> pool;
+
+        if (cfg.threads > 0) pool.reset(new NUtils::TPool(cfg.threads));
+
+        /* Files in flight are limited, each of them holds an open fd */
+
+        const size_t window = std::max(cfg.threads, 1u) * 16;
+
+        while (walk && !Enough()) {
+            auto ref = walk.next();
+
+            if (ref.type != NOs::ENode::File) continue;
+
+            auto file = std::make_shared<NOs::TFile>();
+
+            try {
+                *file = walk.open(ref);
+            } catch (TError &error) {
+                std::cerr << "cannot open file " << ref.path() << std::endl;
+
+                continue;
+            }
+
+            if (!pool) {
+                Evict(*file, ref, *probes[0]);
+            } else {
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+
+                    ready.wait(guard, [&]() { return pending < window; });
+
+                    pending++;
+                }
+
+                pool->Push([this, file, at = std::make_shared<NUtils::NDir::Ref>(
+                                std::move(ref.keep())), &probes](size_t worker) {
+                    Evict(*file, *at, *probes[worker]);
+
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+
+                        pending--;
+                    }
+
+                    ready.notify_one();
+                });
+            }
+        }
+
+        pool.reset();
+
+        std::cout
+            << std::setw(5) << NHumans::Value(freed)
+            << " freed of "
+            << std::setw(5) << NHumans::Value(cached)
+            << " cached in " << files << " files, "
+            << NHumans::Value(cached - freed) << " kept"
+            << std::endl;
+    }
+
+    bool Enough() const noexcept
+    {
+        return cfg.target > 0 && freed >= cfg.target;
+    }
+
+    /* Dirty or mapped and locked pages are not dropped by fadvise(),
+        thus the freed bytes are measured before and after advice */
+
+    void Evict(const NOs::TFile &file, const NUtils::NDir::Ref &ref,
+                NProbe::IBackend &probe) noexcept
+    {
+        if (Enough()) return;
+
+        try {
+            const size_t bytes = NOs::TStat(file).Bytes;
+            const NUtils::TGran all(getpagesize(), NUtils::TSpan(0, bytes));
+
+            const size_t before = probe.Count(file, all).Cached * all.gran();
+
+            if (before > 0) {
+                file.Evict(all);
+
+                const size_t after = probe.Count(file, all).Cached * all.gran();
+
+                const size_t got = before - std::min(before, after);
+
+                freed += got, cached += before, files++;
+
+                if (cfg.verbose) {
+                    std::lock_guard<std::mutex> guard(lock);
+
+                    std::cout
+                        << std::setw(5) << NHumans::Value(got)
+                        << " of "
+                        << std::setw(5) << NHumans::Value(before)
+                        << " " << ref.path() << "\n";
+                }
+            }
+        } catch (TError &error) {
+            std::lock_guard<std::mutex> guard(lock);
+
+            std::cerr << error.what() << " for " << ref.path() << std::endl;
+        }
+    }
+
+    const TCfg              &cfg;
+    size_t                  pending = 0;
+    std::atomic<size_t>     freed{ 0 };
+    std::atomic<size_t>     cached{ 0 };
+    std::atomic<size_t>     files{ 0 };
+    std::mutex              lock;
+    std::condition_variable ready;
+};
@@ -7,6 +7,9 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 
+#include <utility>
+#include <algorithm>
+
 #include "error.h"
 #include "span.h"
 
@@ -106,17 +109,29 @@ namespace NOs {
         TFile() = default;
 
         TFile(const std::string &path, bool direct = false, bool rdonly = true,
-                    bool create = false)
+                    bool create = false, bool append = false)
         {
             int flags =
                     (rdonly ? O_RDONLY : O_WRONLY)
                     | (direct ? O_DIRECT : 0)
-                    | (create ? O_CREAT : 0);
+                    | (create ? O_CREAT : 0)
+                    | (append ? O_APPEND : 0);
 
             if ((fd = ::open(path.data(), flags, 0660)) < 0)
                 throw TError("cannot open file");
         }
 
+        TFile(int at, const char *name)
+        {
+            if ((fd = ::openat(at, name, O_RDONLY)) < 0)
+                throw TError("cannot open file");
+        }
+
+        TFile(TFile &&file) noexcept
+        {
+            std::swap(fd, file.fd);
+        }
+
         ~TFile() noexcept { Close(); }
 
         TFile& operator=(const TFile&) = delete;
@@ -179,6 +194,13 @@ namespace NOs {
             Set(lstat(path.c_str(), &st), st);
         }
 
+        TStat(int at, const char *name)
+        {
+            struct stat st;
+
+            Set(fstatat(at, name, &st, AT_SYMLINK_NOFOLLOW), st);
+        }
+
         void Set(int rv, const struct stat &st) noexcept
         {
             if (rv == 0) {
@@ -186,6 +208,9 @@ namespace NOs {
 
                 Links = st.st_nlink;
                 Bytes = st.st_size;
+                Alloc = uint64_t(st.st_blocks) * 512;
+                Uid = st.st_uid;
+                Mtime = st.st_mtime;
 
                 if (S_ISREG(st.st_mode)) {
                     Type = ENode::File;
@@ -211,8 +236,40 @@ namespace NOs {
         TLoc        Loc;
         uint32_t    Links   = 0;
         uint64_t    Bytes   = 0;
+        uint64_t    Alloc   = 0;    /* bytes of allocated blocks    */
+        uint32_t    Uid     = 0;
+        time_t      Mtime   = 0;
     };
 
+    /* Calls func(TSpan) for each data extent of the range, holes are
+        found by lseek(SEEK_DATA, SEEK_HOLE). Filesystems without their
+        support report a single extent up to the end of the file.   */
+
+    template<typename TFunc>
+    void Extents(const TFile &file, const NUtils::TSpan &range, TFunc &&func)
+    {
+        for (size_t at = range.at; at < range.after(); ) {
+            const off_t data = ::lseek(file, at, SEEK_DATA);
+
+            if (data < 0) {
+                if (errno != ENXIO) func(NUtils::TSpan(at, range.after() - at));
+
+                return;
+            }
+
+            if (size_t(data) >= range.after()) return;
+
+            const off_t hole = ::lseek(file, data, SEEK_HOLE);
+
+            const size_t end = hole < 0 ? range.after()
+                                : std::min(size_t(hole), range.after());
+
+            func(NUtils::TSpan(data, end - data));
+
+            at = end;
+        }
+    }
+
     inline void* MMap_Anon(size_t bytes)
     {
         auto *ptr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
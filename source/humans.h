@@ -2,21 +2,50 @@
 
 #pragma once
 
+#include <charconv>
+#include <string>
 #include "misc.h"
 
 namespace NHumans {
 
-    std::string Value(size_t value)
+    constexpr size_t Width = 24;    /* enough for any Format() result */
+
+    /* Writes value to the buffer of Width bytes without allocations,
+        bigger values are four significant chars and the scale letter
+        truncated, not rounded, i.e. 12345 is 12.3K, returns length */
+
+    inline size_t Format(char *to, size_t value) noexcept
     {
-        if (value < NMisc::Pow10(3)) {
-            return std::to_string(value);
-        } else {
-            const char *scale[] = { "", "K", "M", "G", "T", "P", "E", "Z" };
+        if (value < NMisc::Pow10(3))
+            return std::to_chars(to, to + Width, value).ptr - to;
+
+        const char scale[] = { ' ', 'K', 'M', 'G', 'T', 'P', 'E', 'Z' };
+
+        const auto pow = NMisc::Log1000(value);
+        const size_t small = value / NMisc::Pow10((pow - 1) * 3);
+
+        char digits[Width];
+
+        const size_t len = std::to_chars(digits, digits + Width, small).ptr - digits;
+        const size_t whole = len - 3, frac = 3 - whole;
+
+        size_t at = 0;
 
-            auto pow = NMisc::Log1000(value);
-            double small = value / NMisc::Pow10((pow - 1) * 3);
+        for (size_t z = 0; z < whole; z++) to[at++] = digits[z];
+
+        to[at++] = '.';
+
+        for (size_t z = 0; z < frac; z++) to[at++] = digits[whole + z];
+
+        to[at++] = scale[pow];
+
+        return at;
+    }
+
+    std::string Value(size_t value)
+    {
+        char buf[Width];
 
-            return std::to_string(small / 1000.).substr(0, 4) + *scale[pow];
-        }
+        return std::string(buf, Format(buf, value));
     }
 }
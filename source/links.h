@@ -0,0 +1,200 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "file.h"
+
+namespace NUtils {
+
+    /* Compact open addressing set of inodes, 16 bytes per slot. The
+        device is stored as an index in the small table of seen devs.
+        Each added inode gets sequential number, it may be used as an
+        index of external values. Set stops growing at the limit, the
+        table is kept under 0.7 load, thus it takes at most the power
+        of two of slots above limit / 0.7, and 1.5x of it on growth */
+
+    inline size_t Mix(uint64_t x) noexcept
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+
+        return x ^ (x >> 31);
+    }
+
+    class TLinks {
+    public:
+        enum EPut {
+            PUT_NEW     = 0,
+            PUT_SEEN    = 1,
+            PUT_FULL    = 2,
+        };
+
+        TLinks(size_t limit_) : limit(limit_), slots(1024) { }
+
+        size_t Size() const noexcept { return used; }
+
+        EPut Put(const NOs::TLoc &loc, uint32_t &value)
+        {
+            if (used >= limit) {
+                if (Find(loc, value)) return PUT_SEEN;
+
+                return PUT_FULL;
+            }
+
+            if ((used + 1) * 10 > slots.size() * 7) Grow();
+
+            const uint32_t dev = Dev(loc.Dev);
+
+            for (size_t z = Hash(loc.Ino, dev); ; z++) {
+                TSlot &slot = slots[z & (slots.size() - 1)];
+
+                if (slot.Dev == 0) {
+                    slot = TSlot{ uint64_t(loc.Ino), dev, uint32_t(used++) };
+                    value = slot.Value;
+
+                    return PUT_NEW;
+
+                } else if (slot.Dev == dev && slot.Ino == loc.Ino) {
+                    value = slot.Value;
+
+                    return PUT_SEEN;
+                }
+            }
+        }
+
+    protected:
+        struct TSlot {
+            uint64_t    Ino     = 0;
+            uint32_t    Dev     = 0;    /* index + 1, zero is empty */
+            uint32_t    Value   = 0;
+        };
+
+        bool Find(const NOs::TLoc &loc, uint32_t &value) noexcept
+        {
+            const uint32_t dev = Dev(loc.Dev);
+
+            for (size_t z = Hash(loc.Ino, dev); ; z++) {
+                const TSlot &slot = slots[z & (slots.size() - 1)];
+
+                if (slot.Dev == 0) {
+                    return false;
+                } else if (slot.Dev == dev && slot.Ino == loc.Ino) {
+                    value = slot.Value;
+
+                    return true;
+                }
+            }
+        }
+
+        uint32_t Dev(dev_t dev)
+        {
+            if (last > 0 && devs[last - 1] == dev) return last;
+
+            for (size_t z = 0; z < devs.size(); z++) {
+                if (devs[z] == dev) return last = z + 1;
+            }
+
+            devs.push_back(dev);
+
+            return last = devs.size();
+        }
+
+        static size_t Hash(uint64_t ino, uint32_t dev) noexcept
+        {
+            return Mix(ino ^ (uint64_t(dev) << 56));
+        }
+
+        void Grow()
+        {
+            std::vector<TSlot> was(slots.size() * 2);
+
+            std::swap(was, slots);
+
+            for (const auto &slot : was) {
+                if (slot.Dev == 0) continue;
+
+                for (size_t z = Hash(slot.Ino, slot.Dev); ; z++) {
+                    TSlot &to = slots[z & (slots.size() - 1)];
+
+                    if (to.Dev == 0) {
+                        to = slot;
+
+                        break;
+                    }
+                }
+            }
+        }
+
+        size_t              limit   = 0;
+        size_t              used    = 0;
+        uint32_t            last    = 0;
+        std::vector<dev_t>  devs;
+        std::vector<TSlot>  slots;
+    };
+
+    /* Values of inodes keyed by their numbers given by TLinks. It is
+        sparse, open addressing as in the set, thus only inodes having
+        a value take memory, not all the numbers up to the largest.  */
+
+    template<typename TValue>
+    class TLinkValues {
+    public:
+        TLinkValues() : slots(64) { }
+
+        void Put(uint32_t key, const TValue &value)
+        {
+            if ((used + 1) * 10 > slots.size() * 7) Grow();
+
+            TSlot &slot = Slot(slots, key);
+
+            if (slot.Key == 0) used++;
+
+            slot = TSlot{ key + 1, value };
+        }
+
+        const TValue* Find(uint32_t key) const noexcept
+        {
+            for (size_t z = Mix(key); ; z++) {
+                const TSlot &slot = slots[z & (slots.size() - 1)];
+
+                if (slot.Key == 0) {
+                    return nullptr;
+                } else if (slot.Key == key + 1) {
+                    return &slot.Value;
+                }
+            }
+        }
+
+    protected:
+        struct TSlot {
+            uint32_t    Key     = 0;    /* number + 1, zero is empty */
+            TValue      Value   = { };
+        };
+
+        static TSlot& Slot(std::vector<TSlot> &slots, uint32_t key) noexcept
+        {
+            for (size_t z = Mix(key); ; z++) {
+                TSlot &slot = slots[z & (slots.size() - 1)];
+
+                if (slot.Key == 0 || slot.Key == key + 1) return slot;
+            }
+        }
+
+        void Grow()
+        {
+            std::vector<TSlot> was(slots.size() * 2);
+
+            std::swap(was, slots);
+
+            for (const auto &slot : was) {
+                if (slot.Key != 0) Slot(slots, slot.Key - 1) = slot;
+            }
+        }
+
+        size_t              used    = 0;
+        std::vector<TSlot>  slots;
+    };
+}
@@ -0,0 +1,337 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include <cerrno>
+#include <ctime>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "walk.h"
+#include "bands.h"
+#include "probe.h"
+#include "humans.h"
+
+#ifndef MLOCK_ONFAULT
+#define MLOCK_ONFAULT   0x01
+#endif
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ  22
+#endif
+
+/* Locks resident data of files in memory within the bytes budget. Only
+    pages that are already cached are locked, hottest bands go first, so
+    cold data is never read from disk and the memlock limit is obeyed */
+
+class TLock {
+public:
+    using TSampled = NStats::TParted<NParts::Tailed>;
+
+    struct TCfg {
+        size_t      budget  = 0;    /* zero for RLIMIT_MEMLOCK      */
+        size_t      bands   = 64;   /* bands per file for ranking   */
+        unsigned    seconds = 0;    /* zero for wait of a signal    */
+        bool        verbose = false;
+    };
+
+    TLock(const TCfg &cfg_) : cfg(cfg_) { }
+
+    void Do(const std::string &path)
+    {
+        if (NOs::TStat(path).Type == NOs::ENode::Dir) {
+            NUtils::NDir::TWalk walk(path);
+
+            Do(walk);
+        } else {
+            NUtils::NDir::TOne one(path);
+
+            Do(one);
+        }
+    }
+
+    void Do(std::istream &in, char delim = '\n')
+    {
+        NUtils::NDir::TList list(in, delim);
+
+        Do(list);
+    }
+
+protected:
+    struct TItem {
+        std::string                 path;
+        NOs::TFile                  file;   /* until locking is done */
+        std::vector<NOs::TMapped>   maps;   /* of locked bands only  */
+        std::vector<NUtils::TSpan>  spans;  /* resident data ranges */
+        size_t                      locked = 0;
+    };
+
+    struct THot {
+        double      usage   = 0;
+        size_t      item    = 0;
+        size_t      at      = 0;
+        size_t      after   = 0;
+    };
+
+    void Do(NUtils::NDir::IEnum &walk)
+    {
+        const size_t budget = cfg.budget ? cfg.budget : Limit();
+
+        Files();
+
+        TProbe probe;
+
+        while (walk) {
+            auto ref = walk.next();
+
+            if (ref.type != NOs::ENode::File) continue;
+
+            try {
+                Probe(walk.open(ref), ref.path(), probe);
+            } catch (TError &error) {
+                std::cerr << error.what() << " for " << ref.path() << std::endl;
+            }
+        }
+
+        /* Bands of all files are ranked together by usage, a band
+            is locked only if the whole its resident data fits */
+
+        std::stable_sort(hots.begin(), hots.end(),
+            [](const THot &one, const THot &two) { return one.usage > two.usage; });
+
+        size_t ranges = 0;
+
+        for (const auto &hot : hots) {
+            auto &item = items[hot.item];
+
+            const size_t bytes = Resident(item, hot);
+
+            if (bytes == 0 || locked + bytes > budget) continue;
+
+            if (!Lock(item, hot, ranges)) break;
+
+            locked += bytes, item.locked += bytes;
+        }
+
+        size_t files = 0;
+
+        for (auto &item : items) {
+            item.file.Close();
+
+            if (item.locked == 0) {
+                item.maps.clear();
+            } else if (files++, cfg.verbose) {
+                std::cout
+                    << std::setw(5) << NHumans::Value(item.locked)
+                    << " " << item.path << "\n";
+            }
+        }
+
+        std::cout
+            << std::setw(5) << NHumans::Value(locked)
+            << " locked of "
+            << std::setw(5) << NHumans::Value(cached)
+            << " cached in " << ranges << " ranges of " << files << " files"
+            << std::endl;
+
+        if (locked > 0) Wait();
+    }
+
+    void Probe(NOs::TFile file, const std::string &path, TProbe &probe)
+    {
+        const NUtils::TGran all(getpagesize(), NUtils::TSpan(0, file.Size()));
+
+        const size_t bytes = all.paged();
+
+        if (bytes == 0) return;
+
+        TItem item;
+        TSampled sampled(bytes, cfg.bands);
+
+        probe(file, all, [&](NUtils::TSpan &span) {
+            item.spans.push_back(span);
+
+            sampled(span);
+        });
+
+        if (item.spans.empty()) return;
+
+        cached += static_cast<const NStats::TBand&>(sampled).Value;
+
+        for (size_t z = 0; z < sampled.Size(); z++) {
+            const auto band = sampled.Band(z);
+
+            if (!band.Empty())
+                hots.push_back({ band.Usage(), items.size(), band.At, band.After() });
+        }
+
+        item.path = path;
+        item.file = std::move(file);
+
+        items.push_back(std::move(item));
+    }
+
+    /* Pages of the band, its edges are rounded down to pages thus
+        each page belongs to one band only, even of sub-page bands */
+
+    static NUtils::TSpan Pages(const THot &hot) noexcept
+    {
+        const size_t page = getpagesize();
+
+        const size_t at = NMisc::GranDown(hot.at, page);
+
+        return NUtils::TSpan(at, NMisc::GranDown(hot.after, page) - at);
+    }
+
+    /* Calls func for each resident span clipped to pages of the band */
+
+    template<typename TFunc>
+    static void Each(const TItem &item, const THot &hot, TFunc &&func)
+    {
+        const NUtils::TSpan band = Pages(hot);
+
+        auto it = std::lower_bound(item.spans.begin(), item.spans.end(), band.at,
+                    [](const NUtils::TSpan &span, size_t at) { return span.after() <= at; });
+
+        for (; it != item.spans.end() && it->at < band.after(); it++) {
+            const size_t at = std::max(it->at, band.at);
+
+            func(at, std::min(it->after(), band.after()) - at);
+        }
+    }
+
+    static size_t Resident(const TItem &item, const THot &hot)
+    {
+        size_t bytes = 0;
+
+        Each(item, hot, [&](size_t, size_t len) { bytes += len; });
+
+        return bytes;
+    }
+
+    /* Only pages of the band are mapped. mlock2(MLOCK_ONFAULT) locks
+        pages on faults only and a fresh mapping has none of them, so
+        resident spans are faulted in after it by MADV_POPULATE_READ or
+        by a touch of each page on kernels without it. Plain mlock()
+        is used only on kernels without mlock2(). EINVAL tells the flag
+        is unknown, mlock() would read cold data then, thus locking
+        stops as on any other error.                               */
+
+    bool Lock(TItem &item, const THot &hot, size_t &ranges)
+    {
+        const NUtils::TSpan band = Pages(hot);
+
+        try {
+            item.maps.emplace_back(item.file, band);
+        } catch (TError &error) {
+            std::cerr << error.what() << " for " << item.path << std::endl;
+
+            return false;
+        }
+
+        auto *base = static_cast<char*>(*item.maps.back());
+
+        bool done = true;
+
+        Each(item, hot, [&](size_t at, size_t len) {
+            if (!done) return;
+
+            auto *ptr = base + (at - band.at);
+
+            int ret = ::syscall(SYS_mlock2, ptr, len, MLOCK_ONFAULT);
+
+            if (ret < 0 && errno == ENOSYS) {
+                ret = ::mlock(ptr, len);
+            } else if (ret == 0) {
+                Populate(ptr, len);
+            }
+
+            if (ret < 0) {
+                std::cerr
+                    << "cannot lock memory of " << item.path
+                    << ", errno " << errno << std::endl;
+
+                done = false;
+            } else {
+                ranges++;
+            }
+        });
+
+        return done;
+    }
+
+    static void Populate(char *ptr, size_t len) noexcept
+    {
+        if (::madvise(ptr, len, MADV_POPULATE_READ) == 0) return;
+
+        const size_t page = getpagesize();
+
+        for (size_t off = 0; off < len; off += page)
+            static_cast<const volatile char*>(ptr)[off];
+    }
+
+    /* Each file with resident data is kept open until locking, the
+        soft limit of descriptors is raised up to the hard one    */
+
+    static void Files() noexcept
+    {
+        struct rlimit limit;
+
+        if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+            limit.rlim_cur = limit.rlim_max;
+
+            ::setrlimit(RLIMIT_NOFILE, &limit);
+        }
+    }
+
+    static size_t Limit() noexcept
+    {
+        struct rlimit limit;
+
+        if (::getrlimit(RLIMIT_MEMLOCK, &limit) < 0) return 0;
+
+        return limit.rlim_cur == RLIM_INFINITY ? SIZE_MAX : limit.rlim_cur;
+    }
+
+    void Wait() const
+    {
+        sigset_t set;
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        sigaddset(&set, SIGHUP);
+
+        sigprocmask(SIG_BLOCK, &set, nullptr);
+
+        int sig = 0;
+
+        if (cfg.seconds > 0) {
+            const struct timespec wait = { time_t(cfg.seconds), 0 };
+
+            sig = sigtimedwait(&set, nullptr, &wait);
+        } else {
+            sigwait(&set, &sig);
+        }
+
+        std::cerr << "Unlocking memory";
+
+        if (sig > 0) std::cerr << " on signal " << sig;
+
+        std::cerr << std::endl;
+    }
+
+    const TCfg          &cfg;
+    size_t              locked  = 0;
+    size_t              cached  = 0;
+    std::vector<TItem>  items;
+    std::vector<THot>   hots;
+};
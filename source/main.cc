@@ -1,13 +1,20 @@
 /*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
 
+#include <getopt.h>
 #include <string>
 #include <sys/mman.h>
 
 #include "monit.h"
 #include "file.h"
 #include "top.h"
+#include "evict.h"
+#include "lock.h"
 #include "touch.h"
 #include "write.h"
+#include "delta.h"
+#include "warm.h"
+#include "serve.h"
+#include "map.h"
 
 
 int do_trace(int argc, char *argv[]);
@@ -40,6 +47,14 @@ int main(int argc, char *argv[])
                 return TMod_Read().Handle(argc--, argv++);
             } else if (mod == "write") {
                 return TMod_Write().Handle(argc--, argv++);
+            } else if (mod == "diff") {
+                return TMod_Diff().Handle(argc--, argv++);
+            } else if (mod == "warmup") {
+                return TMod_Warmup().Handle(argc--, argv++);
+            } else if (mod == "serve") {
+                return TMod_Serve().Handle(argc--, argv++);
+            } else if (mod == "map") {
+                return TMod_Map().Handle(argc--, argv++);
             } else {
                 std::cerr << "unknown mode " << mod << std::endl;
 
@@ -60,34 +75,85 @@ int do_trace(int argc, char *argv[])
 {
     extern char *optarg;
     
-    std::string path;
+    std::vector<std::string> paths;
+    bool        input = false;
+    char        delim = '\n';
+    bool        ranged = false;
     TMonit::TCfg  cfg;
 
+    static const struct option longs[] = {
+        { "range", required_argument, nullptr, 'R' },
+        { "width", required_argument, nullptr, 'W' },
+        { nullptr, 0, nullptr, 0 }
+    };
+
     while (true) {
-        static const char opts[] = "f:d:c:r:";
+        static const char opts[] = "f:d:c:r:b:w:j:o:e:i0xp";
 
-        const int opt = getopt(argc, argv, opts);
+        const int opt = getopt_long(argc, argv, opts, longs, nullptr);
 
         if (opt < 0) break;
 
         if (opt == 'f') {
-            path = optarg;
+            paths.push_back(optarg);
+        } else if (opt == 'i') {
+            input = true;
+        } else if (opt == '0') {
+            input = true, delim = '\0';
         } else if (opt == 'd') {
             cfg.delay = std::stoull(optarg);
         } else if (opt == 'c') {
             cfg.count = std::stoull(optarg);
         } else if (opt == 'r') {
             cfg.thresh = std::stod(optarg);
+        } else if (opt == 'w') {
+            cfg.window = std::stoull(optarg);
+        } else if (opt == 'j') {
+            cfg.threads = std::stoul(optarg);
+        } else if (opt == 'o') {
+            cfg.snapshot = optarg;
+        } else if (opt == 'x') {
+            cfg.churn = true;
+        } else if (opt == 'p') {
+            cfg.pages = true;
+        } else if (opt == 'R') {
+            if (!NStats::TWindow::Parse(optarg, cfg.zoom)) {
+                std::cerr << "invalid range " << optarg << std::endl;
+
+                return 1;
+            }
+
+            ranged = true;
+        } else if (opt == 'W') {
+            cfg.zoom.Width = std::stoul(optarg);
+        } else if (opt == 'e') {
+            cfg.events = optarg;
+        } else if (opt == 'b') {
+            if (!NProbe::Parse(optarg, cfg.backend)) {
+                std::cerr << "unknown backend " << optarg << std::endl;
+
+                return 1;
+            }
         }
     }
 
-    if (path.empty()) {
+    if (ranged && cfg.zoom.Width == 0) cfg.zoom.Width = 64;
+
+    if (!paths.empty() && input) {
+        std::cerr << "only one of -f or -i allowed" << std::endl;
+
+        return 1;
+
+    } else if (input) {
+        TMonit(cfg).Do(std::cin, delim);
+
+    } else if (paths.empty()) {
         std::cerr << "path to file is not given" << std::endl;
 
         return 1;
 
     } else {
-        TMonit(cfg).Do(path);
+        TMonit(cfg).Do(paths);
     }
 
     return 0;
@@ -99,9 +165,12 @@ int do_evict(int argc, char *argv[])
     extern char *optarg;
 
     std::string path;
+    bool        input = false;
+    char        delim = '\n';
+    TEvict::TCfg cfg;
 
     while (true) {
-        static const char opts[] = "f:";
+        static const char opts[] = "f:j:t:b:iv0";
 
         const int opt = getopt(argc, argv, opts);
 
@@ -109,18 +178,33 @@ int do_evict(int argc, char *argv[])
 
         if (opt == 'f') {
             path = optarg;
+        } else if (opt == 'i') {
+            input = true;
+        } else if (opt == '0') {
+            input = true, delim = '\0';
+        } else if (opt == 'v') {
+            cfg.verbose = true;
+        } else if (opt == 'j') {
+            cfg.threads = std::stoul(optarg);
+        } else if (opt == 't') {
+            cfg.target = std::stoull(optarg);
+        } else if (opt == 'b') {
+            if (!NProbe::Parse(optarg, cfg.backend)) {
+                std::cerr << "unknown backend " << optarg << std::endl;
+
+                return 1;
+            }
         }
     }
 
-    if (path.empty()) {
-        std::cerr << "path to file is not given" << std::endl;
-
+    if (!path.empty() && input) {
+        std::cerr << "only one of -f or -i allowed" << std::endl;
+    } else if (!path.empty()) {
+        TEvict(cfg).Do(path);
+    } else if (input) {
+        TEvict(cfg).Do(std::cin, delim);
     } else {
-        NOs::TFile file(path);
-
-        const NUtils::TSpan all(0, file.Size());
-
-        file.Evict(all);
+        std::cerr << "path to file is not given" << std::endl;
     }
 
     return 0;
@@ -133,10 +217,11 @@ int do_stats(int argc, char *argv[])
 
     std::string path;
     bool        input = false;
+    char        delim = '\n';
     TTop::TCfg  cfg;
 
     while (true) {
-        static const char opts[] = "f:d:r:l:c:zsi";
+        static const char opts[] = "f:d:r:l:c:j:b:w:S:P:H:o:F:zsix0";
 
         const int opt = getopt(argc, argv, opts);
 
@@ -146,6 +231,8 @@ int do_stats(int argc, char *argv[])
             path = optarg;
         } else if (opt == 'i') {
             input = true;
+        } else if (opt == '0') {
+            input = true, delim = '\0';
         } else if (opt == 'd') {
             cfg.edge = std::stoull(optarg);
         } else if (opt == 'z') {
@@ -156,27 +243,65 @@ int do_stats(int argc, char *argv[])
             cfg.limit = std::stoull(optarg);
         } else if (opt == 'c') {
             cfg.raito = std::stod(optarg);
-        } else if (opt == 'r') {
-            const std::string rname(optarg);
+        } else if (opt == 'j') {
+            cfg.threads = std::stoul(optarg);
+        } else if (opt == 'x') {
+            cfg.extend = true;
+        } else if (opt == 'w') {
+            cfg.window = std::stoull(optarg);
+        } else if (opt == 'S') {
+            cfg.sample = std::stoull(optarg);
+        } else if (opt == 'P') {
+            cfg.files = std::stoull(optarg);
+        } else if (opt == 'o') {
+            cfg.snapshot = optarg;
+        } else if (opt == 'F') {
+            if (!NOutput::Parse(optarg, cfg.format)) {
+                std::cerr << "unknown output format " << optarg << std::endl;
 
-            if (rname == "none") {
-                cfg.reduct = TTop::TCfg::REDUCT_NONE;
-            } else if (rname == "top") {
-                cfg.reduct = TTop::TCfg::REDUCT_TOP;
+                return 1;
+            }
+        } else if (opt == 'H') {
+            const std::string lname(optarg);
+
+            if (lname == "all") {
+                cfg.links = TTop::TCfg::LINKS_ALL;
+            } else if (lname == "first") {
+                cfg.links = TTop::TCfg::LINKS_FIRST;
+            } else if (lname == "every") {
+                cfg.links = TTop::TCfg::LINKS_EVERY;
             } else {
-                std::cerr << "unknown reductor " << rname << std::endl;
+                std::cerr << "unknown hardlinks mode " << lname << std::endl;
+
+                return 1;
+            }
+        } else if (opt == 'b') {
+            if (!NProbe::Parse(optarg, cfg.backend)) {
+                std::cerr << "unknown backend " << optarg << std::endl;
+
+                return 1;
+            }
+        } else if (opt == 'r') {
+            if (!TTop::TCfg::Parse(optarg, cfg.reduct)) {
+                std::cerr << "unknown reductor " << optarg << std::endl;
 
                 return 1;
             }
         }
     }
 
+    if (!cfg.snapshot.empty() && (cfg.sampled() || cfg.extend)) {
+        std::cerr << "snapshot -o needs exact probing, no -S, -P or -x" << std::endl;
+
+        return 1;
+    }
+
     if (!path.empty() && input) {
         std::cerr << "only one of -f or -i allowed" << std::endl;
     } else if (!path.empty()){
         TTop(cfg.validate()).Do(path);
     } else if (input) {
-        TTop(cfg.validate()).Do(std::cin);
+        TTop(cfg.validate()).Do(std::cin, delim);
     } else {
         std::cerr << "path to directory is not given" << std::endl;
     }
@@ -190,10 +315,12 @@ int do_lock(int argc, char *argv[])
     extern char *optarg;
 
     std::string path;
-    uint64_t seconds = 0;
+    bool        input = false;
+    char        delim = '\n';
+    TLock::TCfg cfg;
 
     while (true) {
-        static const char opts[] = "f:s:";
+        static const char opts[] = "f:s:m:n:iv0";
 
         const int opt = getopt(argc, argv, opts);
 
@@ -201,27 +328,29 @@ int do_lock(int argc, char *argv[])
 
         if (opt == 'f') {
             path = optarg;
+        } else if (opt == 'i') {
+            input = true;
+        } else if (opt == '0') {
+            input = true, delim = '\0';
         } else if (opt == 's') {
-            seconds = std::stoull(optarg);
+            cfg.seconds = std::stoul(optarg);
+        } else if (opt == 'm') {
+            cfg.budget = std::stoull(optarg);
+        } else if (opt == 'n') {
+            cfg.bands = std::max(1ul, std::stoul(optarg));
+        } else if (opt == 'v') {
+            cfg.verbose = true;
         }
     }
 
-    if (path.empty()) {
-        std::cerr << "path to file is not given" << std::endl;
+    if (!path.empty() && input) {
+        std::cerr << "only one of -f or -i allowed" << std::endl;
+    } else if (!path.empty()) {
+        TLock(cfg).Do(path);
+    } else if (input) {
+        TLock(cfg).Do(std::cin, delim);
     } else {
-        NOs::TFile file(path);
-        auto map = file.MMap();
-        auto bytes = NOs::TMemRg(map).bytes;
-
-        if (mlock(*map, bytes)) {
-            std::cerr << "Cannot lock memory, errno " << errno << "\n";
-        } else {
-            std::cerr << "Locked " << bytes << " bytes of " << path << "\n";
-
-            sleep(seconds);
-
-            std::cerr << "Unlocking memory after " << seconds << " seconds\n";
-        }
+        std::cerr << "path to file is not given" << std::endl;
     }
 
     return 0;
@@ -232,26 +361,95 @@ void usage() noexcept
 {
     std::cerr
         << "fincore mode [ ARGS ] ..."
-        << "\n\n Mode `trace`, show compact single file cache map"
-        << "\n   -f path    Path to file for tracing"
+        << "\n\n Mode `trace`, show compact files cache map"
+        << "\n   -f path    Path to file or directory, may be repeated"
+        << "\n   -i         Read path names from stdin"
+        << "\n   -0         Read zero delimited path names from stdin"
         << "\n   -c count   How many snaps make"
         << "\n   -d gran    Time granulation, secs"
         << "\n   -r float   Refresh changes threshold"
         << "\n   -s sampl   Minimal samples bands"
+        << "\n   -b kind    Probe backend: auto, mincore, cachestat"
+        << "\n   -w bytes   Mapping window for mincore, 1GiB default"
+        << "\n   -j threads Probe windows of the file in parallel"
+        << "\n   -o path    Keep residency snapshot of the last snap"
+        << "\n   -x         Show page-in and page-out rates of bands"
+        << "\n   -p         Count exact pages loaded and evicted"
+        << "\n   -e path    Append changed pages ranges to log, - for stdout"
+        << "\n   --range off:len  Show the window of files, bytes"
+        << "\n   --width slots    Symbols of the window, 64 default"
         << "\n\n Mode `evict`, try to evicts file data from memory"
-        << "\n   -f path    Path to file for evicting"
+        << "\n   -f path    Path to file or directory for evicting"
+        << "\n   -i         Read path names from stdin"
+        << "\n   -0         Read zero delimited path names from stdin"
+        << "\n   -j threads Evict files on a pool of threads"
+        << "\n   -t bytes   Stop after freeing this many bytes"
+        << "\n   -b kind    Probe backend: auto, mincore, cachestat"
+        << "\n   -v         Show freed bytes of each file"
         << "\n\n Mode `stats`, collects files cache raito"
         << "\n   -f path    Path to directory for stats"
         << "\n   -i         Read path names from stdin"
-        << "\n   -d depth   Depth detalization limit"
+        << "\n   -0         Read zero delimited path names from stdin"
+        << "\n   -d depth   Depth detalization limit, prefix depth"
         << "\n   -z         Show entries with zero usage"
-        << "\n   -r kind    Type of reduction: none, top"
+        << "\n   -r kind    Type of reduction: none, top, ext, prefix,"
+        << "\n              uid, age; the last four group files"
         << "\n   -l items   Items limit for reduction"
         << "\n   -s         Collect root summary stats"
         << "\n   -c raito   Cache filter raito for aggr"
-        << "\n\n Mope `lock`, locks file for a while"
-        << "\n   -f path    Path to file for locking in memory"
-        << "\n   -s seconds How long to keep memory locked"
+        << "\n   -j threads Probe files on a pool of threads"
+        << "\n   -b kind    Probe backend: auto, mincore, cachestat"
+        << "\n   -x         Show dirty, writeback and evicted bytes"
+        << "\n   -w bytes   Mapping window for mincore, 1GiB default"
+        << "\n   -S pages   Estimate usage by sampling pages of files"
+        << "\n   -P bytes   Probe a sample of files, chance is size by bytes"
+        << "\n   -H mode    Hardlinks charging: all, first, every"
+        << "\n   -o path    Write residency snapshot, not with -S, -P, -x"
+        << "\n   -F format  Output: human, csv, ndjson, binary"
+        << "\n\n Mode `diff`, compares two residency snapshots"
+        << "\n   -a path    Older snapshot file"
+        << "\n   -b path    Newer snapshot file"
+        << "\n   -v         Show changed ranges of files"
+        << "\n   -z         Show files without changes"
+        << "\n\n Mode `map`, shows any window of a file cache map"
+        << "\n   -i path    Residency snapshot to render, no probing"
+        << "\n   -f path    File to probe, or its record in snapshot"
+        << "\n   --range off:len  Window of file in bytes, whole default"
+        << "\n   --width slots    Symbols of the window, 64 default"
+        << "\n\n Mode `warmup`, brings snapshot ranges back to cache"
+        << "\n   -i path    Residency snapshot to replay"
+        << "\n   -f path    Base directory for relative paths"
+        << "\n   -j threads Number of parallel workers, 4 default"
+        << "\n   -g bytes   Coalesce ranges closer than, 1MiB default"
+        << "\n   -b bytes   Single read ahead request size, 4MiB"
+        << "\n   -r mbytes  Bandwidth cap in MiB/s, no cap default"
+        << "\n   -p secs    Progress report period, 5 default"
+        << "\n   -a         Use fadvise(WILLNEED) over readahead()"
+        << "\n\n Mode `serve`, exports cache stats of a tree"
+        << "\n   -f path    Path to directory for serving"
+        << "\n   -u path    Unix socket to answer stats on connect"
+        << "\n   -o path    Prometheus textfile to refresh each tick"
+        << "\n   -d msecs   Scheduler tick, 1000 default"
+        << "\n   -p secs    Mean rescan period of a file, 60 default"
+        << "\n   -r secs    Period of walks for new files, 600 default"
+        << "\n   -c ticks   Stop after given ticks, run forever default"
+        << "\n   -l items   Top entries to publish, 16 default"
+        << "\n   -R kind    Reduction as for stats: top default, none, ext,"
+        << "\n              prefix, uid, age"
+        << "\n   -D depth   Depth detalization limit, prefix depth"
+        << "\n   -b kind    Probe backend: auto, mincore, cachestat"
+        << "\n   -w bytes   Mapping window for mincore, 1GiB default"
+        << "\n   -n         Rescan files on inotify events, at most once per"
+        << "\n              -p each; walks stop and rescans are stretched 16x"
+        << "\n              while all directories are watched"
+        << "\n\n Mope `lock`, locks cached data of files for a while"
+        << "\n   -f path    Path to file or directory for locking"
+        << "\n   -i         Read path names from stdin"
+        << "\n   -0         Read zero delimited path names from stdin"
+        << "\n   -m bytes   Memory budget, RLIMIT_MEMLOCK default"
+        << "\n   -n bands   Bands per file for hotness ranking, 64"
+        << "\n   -s seconds How long to keep, until signal default"
+        << "\n   -v         Show locked bytes of each file"
         << "\n\n Mode `read`, generates IO read load on a file"
         << "\n   -f path    Path to real file for read from"
         << "\n   -b bytes   Read granularity in bytes"
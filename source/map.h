@@ -0,0 +1,143 @@
+#pragma once /*__ GPL 3.0, 2020 Alexander Soloviev (no.friday@yandex.ru) */
+
+#include <getopt.h>
+#include <unistd.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "file.h"
+#include "snap.h"
+#include "probe.h"
+#include "print.h"
+#include "pages.h"
+#include "humans.h"
+
+class TMod_Map {
+
+    struct TCfg {
+        std::string Snap;       /* Snapshot to render, no probing   */
+        std::string Path;       /* File to probe or to pick in snap */
+        NStats::TWindow Zoom;
+    };
+
+public:
+    int Handle(int argc, char *argv[])
+    {
+        extern char *optarg;
+
+        static const struct option longs[] = {
+            { "range", required_argument, nullptr, 'R' },
+            { "width", required_argument, nullptr, 'W' },
+            { nullptr, 0, nullptr, 0 }
+        };
+
+        TCfg cfg{ };
+
+        cfg.Zoom.Width = 64;
+
+        while (true) {
+            static const char opts[] = "i:f:";
+
+            const int opt = getopt_long(argc, argv, opts, longs, nullptr);
+
+            if (opt < 0) break;
+
+            if (opt == 'i') {
+                cfg.Snap = optarg;
+            } else if (opt == 'f') {
+                cfg.Path = optarg;
+            } else if (opt == 'R') {
+                if (!NStats::TWindow::Parse(optarg, cfg.Zoom)) {
+                    std::cerr << "invalid range " << optarg << "\n";
+
+                    return 1;
+                }
+            } else if (opt == 'W') {
+                cfg.Zoom.Width = std::max(1ul, std::stoul(optarg));
+            }
+        }
+
+        if (cfg.Snap.empty() && cfg.Path.empty()) {
+            std::cerr << "snapshot -i or file -f has to be given\n";
+
+            return 1;
+        }
+
+        return cfg.Snap.empty() ? Probe(cfg) : Replay(cfg);
+    }
+
+protected:
+    /* Records of the snapshot are rendered without touching the files,
+        with -f only the record of the same path is rendered      */
+
+    int Replay(const TCfg &cfg)
+    {
+        const NSnap::TReader snap(cfg.Snap);
+
+        const size_t page = snap.Head().Page;
+
+        snap.Each([&](const NSnap::TItem &item) {
+            if (!cfg.Path.empty() && item.Path != cfg.Path) return;
+
+            index.Clear();
+
+            for (auto runs = item.Runs(); runs;) {
+                const auto run = runs.next();
+
+                index.Add(run.At, run.Pages);
+            }
+
+            /* Snapshots have no extents, the whole file is taken as data */
+
+            Print(cfg, item.Rec->Size, page, item.Path, { NUtils::TSpan(0, item.Rec->Size) });
+        });
+
+        return 0;
+    }
+
+    int Probe(const TCfg &cfg)
+    {
+        const size_t page = getpagesize();
+
+        NOs::TFile file(cfg.Path);
+
+        const size_t bytes = NOs::TStat(file).Bytes;
+
+        std::vector<NUtils::TSpan> extents;
+
+        NOs::Extents(file, NUtils::TSpan(0, bytes), [&](const NUtils::TSpan &data) {
+            extents.push_back(data);
+        });
+
+        TProbe probe;
+
+        probe(file, NUtils::TSpan(0, bytes), [&](NUtils::TSpan &span) {
+            index.Add(span.at / page, NMisc::DivUp(span.bytes, page));
+        });
+
+        Print(cfg, bytes, page, cfg.Path, extents);
+
+        return 0;
+    }
+
+    void Print(const TCfg &cfg, size_t size, size_t page, std::string_view path,
+                const std::vector<NUtils::TSpan> &extents)
+    {
+        const auto range = cfg.Zoom.Pages(size, page);
+
+        const size_t pages = range.second - range.first;
+        const size_t used = index.Count(range.first, range.second);
+
+        std::cout
+            << std::fixed << std::setprecision(1) << std::setw(5)
+            << (pages > 0 ? 100. * used / pages : 0.)
+            << "% [" << cfg.Zoom.Dots(index, size, page, extents) << "] "
+            << NHumans::Value(range.first * page) << "-"
+            << NHumans::Value(range.second * page) << " "
+            << path << "\n";
+    }
+
+    NPages::TIndex  index;
+};
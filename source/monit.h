@@ -3,17 +3,33 @@
 #pragma once
 
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <ctime>
 #include <cstring>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <condition_variable>
 
 #include "probe.h"
+#include "backend.h"
+#include "split.h"
+#include "snap.h"
 #include "diff.h"
 #include "print.h"
+#include "churn.h"
+#include "pages.h"
+#include "output.h"
 #include "ticks.h"
 #include "parts.h"
+#include "pool.h"
+#include "walk.h"
 
 class TMonit {
 public:
@@ -27,48 +43,490 @@ public:
         float       thresh  = 0.1;
         unsigned    bands   = 48;
         unsigned    subs    = 8192;
+        NProbe::EKind backend = NProbe::KIND_AUTO;
+        size_t      window  = TProbe::Window;
+        unsigned    threads = 0;    /* zero for serial probing      */
+        std::string snapshot;   /* rewritten on each printed snap */
+        bool        churn   = false;    /* page-in and out rates    */
+        bool        pages   = false;    /* exact pages in and out   */
+        std::string events;     /* log of changed pages ranges    */
+        NStats::TWindow zoom;   /* zero width for the bands only  */
     };
 
     TMonit(const TCfg &cfg_) : cfg(cfg_) { }
 
     void Do(std::string &path)
     {
-        TProbe probe;
-        NParts::TScale scale(cfg.subs);
+        std::vector<std::string> paths{ path };
 
-        TSampled::Ref  was;
+        Do(paths);
+    }
+
+    void Do(std::istream &in, char delim = '\n')
+    {
+        NUtils::NDir::TList list(in, delim);
+
+        std::vector<std::string> paths;
+
+        while (list) {
+            auto ref = list.next();
+
+            if (ref.type == NOs::ENode::File) paths.push_back(ref.path());
+        }
+
+        Do(paths);
+    }
+
+    /* Directories are expanded to all of their files once, the set of
+        traced files is fixed. Each file gets own line only when its
+        change passes the threshold, the line is ended by the path   */
+
+    void Do(const std::vector<std::string> &paths)
+    {
+        many = paths.size() > 1;
+
+        for (auto &path : paths) {
+            if (NOs::TStat(path).Type != NOs::ENode::Dir) {
+                traces.emplace_back(path);
+            } else {
+                NUtils::NDir::TWalk walk(path);
+
+                many = true;
+
+                while (walk) {
+                    auto ref = walk.next();
+
+                    if (ref.type == NOs::ENode::File)
+                        traces.emplace_back(path + "/" + ref.path());
+                }
+            }
+        }
+
+        if (traces.empty()) throw TError("no files to trace");
+
+        /* cachestat() is able to count pages per band without mmap(),
+            but snapshots need exact runs, they are given by mincore() */
+
+        runs = !cfg.snapshot.empty();
+        exact = cfg.pages || !cfg.events.empty();
+
+        if (!cfg.events.empty()) Log(cfg.events);
+
+        /* Each kept file holds a descriptor and a mapping, huge sets of
+            files are opened on every tick within the process limits */
+
+        keep = traces.size() <= Keep();
+
+        const bool count = !runs && !exact && cfg.zoom.Width == 0
+                && NProbe::Resolve(cfg.backend) == NProbe::KIND_CACHESTAT;
+
+        for (size_t z = 0; z < std::max(cfg.threads, 1u); z++) {
+            workers.emplace_back(cfg.window);
+
+            if (count) workers.back().counter = NProbe::Make(cfg.backend);
+        }
+
+        /* Single file is split by windows over threads, many files are
+            probed each one by a worker in the same tick of the loop  */
+
+        std::unique_ptr<NUtils::TPool> pool;
+
+        if (cfg.threads > 0 && many) {
+            pool.reset(new NUtils::TPool(cfg.threads));
+        } else if (cfg.threads > 0 && !count) {
+            split.reset(new TSplit(cfg.threads, cfg.window));
+        }
 
         for (TTicks ti(cfg.delay * 1000, cfg.count); ti();) {
-            NOs::TFile  file;
+            if (pool) {
+                cursor = 0, left = pool->Size();
+
+                for (size_t z = 0; z < pool->Size(); z++) {
+                    pool->Push([this](size_t worker) { Drain(worker); });
+                }
+
+                std::unique_lock<std::mutex> guard(lock);
 
-            try {
-                file = NOs::TFile(path);
-            } catch (TError &error) {
-                std::cerr << error.what() << std::endl;
+                ready.wait(guard, [this]() { return left == 0; });
+
+            } else if (many) {
+                for (auto &trace : traces) Guard(trace, workers[0]);
+            } else if (!Probe(traces[0], workers[0])) {
+                std::cerr << traces[0].error << std::endl;
 
                 break;
             }
 
-            auto map = file.MMap();
+            Report();
+        }
+    }
+
+protected:
+    struct TTrace {
+        TTrace(std::string path_) : path(std::move(path_)) { }
 
-            const size_t bytes = ((const NOs::TMemRg&)map).paged();
+        std::string     path;
+        std::string     error;
+        std::string     told;   /* the last reported error      */
+        TSampled::Ref   was;
+        TSampled::Ref   now;
+        NOs::TStat      info{ std::string() };  /* of the last probe */
+        NOs::TStat      held{ std::string() };  /* of printed snap  */
+        std::vector<NUtils::TSpan> spans;   /* of the last probe    */
+        std::vector<NUtils::TSpan> kept;    /* of the printed snap  */
+        std::vector<NUtils::TSpan> extents; /* data of the file     */
+        std::unique_ptr<NStats::TChurn> churn;
+        NPages::TPages  live;   /* exact pages of the last probe    */
+        NPages::TPages  last;   /* of the probe on previous tick    */
+        bool            fresh   = true; /* last is of another file  */
+        NPages::TIndex  index;  /* runs of the last probe for zoom  */
+        size_t          ins     = 0;    /* pages since printed snap */
+        size_t          outs    = 0;
+        std::chrono::steady_clock::time_point stamp;    /* of probe */
+        NOs::TFile      file;
+        NOs::TMapped    map;
+        size_t          mapped  = 0;    /* file bytes of the map    */
+    };
 
-            TSampled::Ref now(new TSampled(bytes, scale(bytes)));
+    struct TWorker {
+        TWorker(size_t window) : probe(window) { }
+
+        TProbe              probe;
+        NProbe::TBackend    counter;
+    };
+
+    /* Errors of a file in the set are reported once and the file is
+        skipped for the tick, single file trace is stopped on them */
+
+    void Guard(TTrace &trace, TWorker &worker) noexcept
+    {
+        try {
+            Probe(trace, worker);
+        } catch (TError &error) {
+            trace.error = error.what();
+        }
+    }
+
+    /* Each worker of the pool takes the next file of the set until
+        all of them are probed, the pool gets a task per worker on
+        a tick, not a task per file. The task captures only this and
+        fits std::function without allocation, the pool queues may
+        still allocate on growth.                                  */
+
+    void Drain(size_t worker) noexcept
+    {
+        for (size_t at; (at = cursor++) < traces.size(); )
+            Guard(traces[at], workers[worker]);
+
+        std::lock_guard<std::mutex> guard(lock);
+
+        if (--left == 0) ready.notify_one();
+    }
+
+    /* Probe of a steady file does no heap allocation: the file and its
+        mapping are kept between ticks, bands buffers are swapped with
+        the printed snap and cleared, spans vectors keep capacity  */
+
+    bool Probe(TTrace &trace, TWorker &worker)
+    {
+        trace.error.clear();
+
+        if (!Open(trace)) return false;
+
+        const NOs::TStat prev = trace.info;
+
+        trace.info = NOs::TStat(trace.file);
+
+        /* Pages of a rotated or resized file aren't comparable with the
+            last probe, exact delta is skipped for one tick           */
+
+        if (trace.info.Loc.Dev != prev.Loc.Dev || trace.info.Loc.Ino != prev.Loc.Ino
+                || trace.info.Bytes != prev.Bytes)
+            trace.fresh = true;
+
+        const NUtils::TGran all(getpagesize(), NUtils::TSpan(0, trace.info.Bytes));
+
+        const size_t bytes = all.paged();
+
+        if (bytes == 0) throw TError("cannot trace an empty file");
+
+        auto &now = trace.now;
+
+        if (now && static_cast<const NStats::TBand&>(*now).Limit == bytes) {
+            now->Reset();
+        } else {
+            NParts::TScale scale(cfg.subs);
+
+            now.reset(new TSampled(bytes, scale(bytes)));
+        }
+
+        /* Holes are marked in bands and are not probed with mincore() */
+
+        trace.extents.clear();
+
+        NOs::Extents(trace.file, all, [&](const NUtils::TSpan &data) {
+            trace.extents.push_back(data);
+        });
+
+        now->Allocate(trace.extents, all.gran());
+
+        if (worker.counter) {
+            now->Fill([&](const NStats::TBand &band) {
+                const NUtils::TSpan span(band.At, band.Limit);
+
+                return worker.counter->Count(trace.file, span).Cached * all.gran();
+            });
+        } else {
+            trace.spans.clear();
+            trace.live.Clear();
+            trace.index.Clear();
+
+            auto feed = [&](NUtils::TSpan &span) {
+                if (runs) trace.spans.push_back(span);
+
+                const size_t at = span.at / all.gran();
+                const size_t pages = NMisc::DivUp(span.bytes, all.gran());
+
+                if (exact) trace.live.Add(at, pages);
+
+                if (cfg.zoom.Width > 0) trace.index.Add(at, pages);
+
+                (*now)(span);
+            };
+
+            if (split) {
+                (*split)(trace.file, all, feed);
+            } else if (Remap(trace)) {
+                worker.probe(trace.map, trace.extents, feed);
+            } else {
+                worker.probe(trace.file, all, feed);
+            }
+        }
+
+        if (cfg.churn) Churn(trace, *now);
+
+        if (!keep) trace.map = NOs::TMapped(), trace.file.Close();
+
+        return true;
+    }
+
+    /* The file is reopened only when its path points to another inode,
+        for example after rotation of logs by rename. On opening error
+        the trace is waiting for the file on the next ticks.         */
+
+    bool Open(TTrace &trace)
+    {
+        struct stat st;
 
-            probe(map, [&](NUtils::TSpan &span) { (*now)(span); });
+        if (trace.file && ::stat(trace.path.c_str(), &st) == 0
+                && st.st_dev == trace.info.Loc.Dev && st.st_ino == trace.info.Loc.Ino)
+            return true;
 
-            if (!was || NStats::TDiff()(*was, *now) > cfg.thresh) {
-                was.reset(now.release());
+        /* Old descriptor would pin space of an unlinked file */
+
+        trace.map = NOs::TMapped(), trace.mapped = 0, trace.file.Close();
+
+        try {
+            trace.file = NOs::TFile(trace.path);
+        } catch (TError &error) {
+            trace.error = error.what();
+
+            return false;
+        }
+
+        return true;
+    }
+
+    /* Whole file is mapped while it fits the window, it is mapped again
+        only on size change, larger files are mapped by windows on probe */
+
+    bool Remap(TTrace &trace)
+    {
+        if (trace.info.Bytes > cfg.window) {
+            trace.map = NOs::TMapped();
+
+        } else if (!trace.map || trace.mapped != trace.info.Bytes) {
+            trace.map = NOs::TMapped(trace.file, NUtils::TSpan(0, trace.info.Bytes));
+            trace.mapped = trace.info.Bytes;
+        }
+
+        return bool(trace.map);
+    }
+
+    /* Rates are decayed over three ticks, but not faster than in the
+        three seconds for the tight loop without a delay between ticks */
+
+    void Churn(TTrace &trace, const TSampled &now)
+    {
+        const auto stamp = std::chrono::steady_clock::now();
+
+        if (!trace.churn) {
+            const NStats::TChurn::TSecs depth(3. * std::max(cfg.delay, 1u));
+
+            trace.churn.reset(new NStats::TChurn(cfg.bands, depth));
+        }
+
+        (*trace.churn)(now, stamp - trace.stamp);
+
+        trace.stamp = stamp;
+    }
+
+    static size_t Keep() noexcept
+    {
+        struct rlimit limit;
+
+        if (::getrlimit(RLIMIT_NOFILE, &limit) < 0) return 0;
+
+        return std::min<size_t>(limit.rlim_cur / 2, 16384);
+    }
+
+    void Report()
+    {
+        bool changed = false;
+
+        const std::string stamp = log ? Epoch() : std::string();
+
+        for (auto &trace : traces) {
+            if (!trace.error.empty()) {
+                if (trace.error != trace.told)
+                    std::cerr << trace.error << " for " << trace.path << std::endl;
+
+                trace.told = trace.error;
+
+                continue;
+            }
+
+            trace.told.clear();
+
+            auto &was = trace.was, &now = trace.now;
+
+            if (exact) {
+                if (was && !trace.fresh) Exact(trace, stamp);
+
+                std::swap(trace.last, trace.live);
+
+                trace.fresh = false;
+            }
+
+            if (!was || was->Size() != now->Size()
+                    || NStats::TDiff()(*was, *now) > cfg.thresh
+                    || Moved(trace) > cfg.thresh) {
+                was.swap(now);
 
                 std::cout
                     << Stamp()
                     << " "
-                    << NStats::TPrint(*was, cfg.bands)
-                    << std::endl;
+                    << NStats::TPrint(*was, cfg.bands);
+
+                if (exact) {
+                    std::cout
+                        << " +" << NHumans::Value(trace.ins * page)
+                        << " -" << NHumans::Value(trace.outs * page);
+
+                    trace.ins = trace.outs = 0;
+                }
+
+                if (many) std::cout << " " << trace.path;
+
+                std::cout << std::endl;
+
+                if (cfg.zoom.Width > 0) Zoom(trace);
+
+                if (trace.churn) {
+                    std::cout << std::string(22, ' ');
+
+                    (*trace.churn)(std::cout, *was) << std::endl;
+                }
+
+                if (runs) trace.kept.swap(trace.spans), trace.held = trace.info;
+
+                changed = true;
+            }
+        }
+
+        if (runs && changed) Save();
+
+        if (log) log->Flush();
+    }
+
+    /* Zoomed window of the last probe under the bands line */
+
+    void Zoom(const TTrace &trace) const
+    {
+        const auto range = cfg.zoom.Pages(trace.info.Bytes, page);
+
+        std::cout
+            << std::string(22, ' ')
+            << "[" << cfg.zoom.Dots(trace.index, trace.info.Bytes, page, trace.extents) << "] "
+            << NHumans::Value(range.first * page) << "-"
+            << NHumans::Value(range.second * page) << std::endl;
+    }
+
+    /* Exact pages loaded and evicted between the two last probes, they
+        are summed up to the next printed snap and written to the log */
+
+    void Exact(TTrace &trace, const std::string &stamp)
+    {
+        delta(trace.last, trace.live, [&](size_t at, size_t pages, bool in) {
+            (in ? trace.ins : trace.outs) += pages;
+
+            if (log) {
+                log->Put(stamp);
+                log->Put(in ? " + " : " - ");
+                log->Num(at);
+                log->Put(' ');
+                log->Num(pages);
+                log->Put(' ');
+                log->Put(trace.path);
+                log->Put('\n');
             }
+        });
+    }
+
+    double Moved(const TTrace &trace) const noexcept
+    {
+        const size_t bytes = static_cast<const NStats::TBand&>(*trace.now).Limit;
+
+        return bytes > 0 ? double(trace.ins + trace.outs) * page / bytes : 0;
+    }
+
+    /* Events are appended to the log, it is written on each tick only */
+
+    void Log(const std::string &path)
+    {
+        if (path != "-") logf = NOs::TFile(path, false, false, true, true);
+
+        log.reset(new NOutput::TBuffer(path == "-" ? STDOUT_FILENO : int(logf)));
+    }
+
+    /* Unix time in msecs resolution for the events log lines */
+
+    static std::string Epoch()
+    {
+        struct timespec now;
+
+        clock_gettime(CLOCK_REALTIME, &now);
+
+        char line[32];
+
+        snprintf(line, sizeof(line), "%lld.%03ld", (long long)now.tv_sec, now.tv_nsec / 1000000);
+
+        return line;
+    }
+
+    void Save() const
+    {
+        NSnap::TWriter writer(cfg.snapshot);
+
+        for (auto &trace : traces) {
+            if (trace.was)
+                writer.Add(trace.path, trace.held.Bytes, trace.held.Loc, trace.kept);
         }
+
+        writer.Close();
     }
 
+public:
     std::string Stamp() const noexcept
     {
         using namespace std;
@@ -88,6 +546,21 @@ public:
     }
 
 protected:
-    const TCfg      &cfg;
+    const TCfg              &cfg;
+    bool                    many    = false;
+    bool                    runs    = false;
+    bool                    keep    = true;     /* files open on ticks */
+    bool                    exact   = false;
+    size_t                  page    = getpagesize();
+    NPages::TDelta          delta;
+    NOs::TFile              logf;
+    std::unique_ptr<NOutput::TBuffer> log;
+    std::vector<TTrace>     traces;
+    std::vector<TWorker>    workers;
+    std::unique_ptr<TSplit> split;
+    std::atomic<size_t>     cursor{ 0 };    /* next file for pool */
+    size_t                  left    = 0;    /* busy pool workers  */
+    std::mutex              lock;
+    std::condition_variable ready;
 };
 
@@ -0,0 +1,336 @@
+#pragma once /*__ GPL 3.0, 2020 Alexander Soloviev (no.friday@yandex.ru) */
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <charconv>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "error.h"
+#include "humans.h"
+
+namespace NOutput {
+
+    enum EFormat {
+        FORMAT_HUMAN    = 0,
+        FORMAT_CSV      = 1,
+        FORMAT_NDJSON   = 2,
+        FORMAT_BINARY   = 3,
+    };
+
+    inline bool Parse(const std::string &name, EFormat &format) noexcept
+    {
+        if (name == "human") {
+            format = FORMAT_HUMAN;
+        } else if (name == "csv") {
+            format = FORMAT_CSV;
+        } else if (name == "ndjson") {
+            format = FORMAT_NDJSON;
+        } else if (name == "binary") {
+            format = FORMAT_BINARY;
+        } else {
+            return false;
+        }
+
+        return true;
+    }
+
+    /* Large reusable buffer over the file descriptor, it is written
+        only when full or on the explicit flush, never by lines */
+
+    class TBuffer {
+    public:
+        TBuffer(int fd_ = STDOUT_FILENO, size_t size = 1 << 20)
+            : fd(fd_), buf(size) { }
+
+        TBuffer(const TBuffer&) = delete;
+
+        ~TBuffer()
+        {
+            try {
+                Flush();
+            } catch (TError &error) {
+                /* nothing to do at exit, the output is broken */
+            }
+        }
+
+        char* Reserve(size_t bytes)
+        {
+            if (used + bytes > buf.size()) Flush();
+
+            if (bytes > buf.size()) buf.resize(bytes);
+
+            return buf.data() + used;
+        }
+
+        void Commit(size_t bytes) noexcept { used += bytes; }
+
+        void Put(std::string_view text)
+        {
+            memcpy(Reserve(text.size()), text.data(), text.size());
+
+            used += text.size();
+        }
+
+        void Put(char one)
+        {
+            *Reserve(1) = one, used++;
+        }
+
+        void Num(uint64_t value)
+        {
+            char *at = Reserve(NHumans::Width);
+
+            used += std::to_chars(at, at + NHumans::Width, value).ptr - at;
+        }
+
+        /* Human value aligned to the right in the field of width */
+
+        void Human(uint64_t value, size_t width)
+        {
+            char tmp[NHumans::Width];
+
+            const size_t len = NHumans::Format(tmp, value);
+
+            Pad(std::string_view(tmp, len), width);
+        }
+
+        void Pad(std::string_view text, size_t width)
+        {
+            const size_t fill = width > text.size() ? width - text.size() : 0;
+
+            char *at = Reserve(fill + text.size());
+
+            memset(at, ' ', fill);
+            memcpy(at + fill, text.data(), text.size());
+
+            used += fill + text.size();
+        }
+
+        void Flush()
+        {
+            for (size_t off = 0; off < used; ) {
+                const ssize_t got = ::write(fd, buf.data() + off, used - off);
+
+                if (got < 0 && errno == EINTR) continue;
+
+                if (got <= 0) {
+                    used = 0;
+
+                    throw TError("cannot write output");
+                }
+
+                off += got;
+            }
+
+            used = 0;
+        }
+
+    protected:
+        int                 fd      = -1;
+        size_t              used    = 0;
+        std::vector<char>   buf;
+    };
+
+    /* Stats row in any format. Binary output starts with a header of
+        magic "FINCREC1", version and record size, each record is the
+        fixed 64 bytes TRecord in host byte order, the path follows it
+        and is padded with zeroes to 8 bytes alignment.             */
+
+    struct TRow {
+        uint64_t            Used    = 0;
+        uint64_t            Size    = 0;
+        uint64_t            Alloc   = 0;    /* bytes without holes      */
+        uint64_t            Dirty   = 0;
+        uint64_t            Wback   = 0;
+        uint64_t            Evicted = 0;
+        uint64_t            Margin  = 0;    /* of sampled estimation    */
+        unsigned            Depth   = 0;
+        std::string_view    Path;
+    };
+
+    struct TRecord {
+        uint64_t    Used;
+        uint64_t    Size;
+        uint64_t    Alloc;
+        uint64_t    Dirty;
+        uint64_t    Wback;
+        uint64_t    Evicted;
+        uint64_t    Margin;
+        uint32_t    Depth;
+        uint32_t    Path;   /* bytes of path following the record */
+    };
+
+    static_assert(sizeof(TRecord) == 64, "binary record layout");
+
+    class TFormat {
+    public:
+        TFormat(EFormat format_, bool sampled_, bool extended_)
+            : format(format_), sampled(sampled_), extended(extended_) { }
+
+        void operator()(const TRow &row)
+        {
+            if (!started) Start();
+
+            if (format == FORMAT_CSV) {
+                Csv(row);
+            } else if (format == FORMAT_NDJSON) {
+                Json(row);
+            } else if (format == FORMAT_BINARY) {
+                Binary(row);
+            } else {
+                Human(row);
+            }
+        }
+
+        void Flush()
+        {
+            if (!started) Start();
+
+            out.Flush();
+        }
+
+    protected:
+        void Start()
+        {
+            started = true;
+
+            if (format == FORMAT_CSV) {
+                out.Put("used,size,allocated,dirty,writeback,evicted,margin,depth,path\n");
+            } else if (format == FORMAT_BINARY) {
+                const uint32_t head[2] = { 2, sizeof(TRecord) };
+
+                out.Put("FINCREC1");
+                out.Put(std::string_view(reinterpret_cast<const char*>(head), sizeof(head)));
+            }
+        }
+
+        void Human(const TRow &row)
+        {
+            out.Human(row.Used, 5);
+
+            if (sampled) {
+                out.Put(" +- ");
+                out.Human(row.Margin, 5);
+            }
+
+            out.Put(" of ");
+            out.Human(row.Size, 5);
+            out.Put(' ');
+
+            /* Allocated bytes are given by stat(), not by the backend */
+
+            if (row.Alloc < row.Size) {
+                out.Put("a ");
+                out.Human(row.Alloc, 5);
+                out.Put(' ');
+            }
+
+            if (extended) {
+                out.Put("d ");
+                out.Human(row.Dirty, 5);
+                out.Put(" w ");
+                out.Human(row.Wback, 5);
+                out.Put(" e ");
+                out.Human(row.Evicted, 5);
+                out.Put(' ');
+            }
+
+            char depth[NHumans::Width];
+
+            const size_t len = std::to_chars(depth, depth + sizeof(depth), row.Depth).ptr - depth;
+
+            out.Pad(std::string_view(depth, len), 2);
+            out.Put(' ');
+            out.Put(row.Path);
+            out.Put('\n');
+        }
+
+        void Csv(const TRow &row)
+        {
+            for (auto value : { row.Used, row.Size, row.Alloc, row.Dirty, row.Wback,
+                                    row.Evicted, row.Margin, uint64_t(row.Depth) }) {
+                out.Num(value);
+                out.Put(',');
+            }
+
+            if (row.Path.find_first_of(",\"\r\n") == std::string_view::npos) {
+                out.Put(row.Path);
+            } else {
+                out.Put('"');
+
+                for (char one : row.Path) {
+                    if (one == '"') out.Put('"');
+
+                    out.Put(one);
+                }
+
+                out.Put('"');
+            }
+
+            out.Put('\n');
+        }
+
+        void Json(const TRow &row)
+        {
+            out.Put("{\"used\":");
+            out.Num(row.Used);
+            out.Put(",\"size\":");
+            out.Num(row.Size);
+            out.Put(",\"allocated\":");
+            out.Num(row.Alloc);
+            out.Put(",\"dirty\":");
+            out.Num(row.Dirty);
+            out.Put(",\"writeback\":");
+            out.Num(row.Wback);
+            out.Put(",\"evicted\":");
+            out.Num(row.Evicted);
+            out.Put(",\"margin\":");
+            out.Num(row.Margin);
+            out.Put(",\"depth\":");
+            out.Num(row.Depth);
+            out.Put(",\"path\":\"");
+
+            static const char hex[] = "0123456789abcdef";
+
+            for (unsigned char one : row.Path) {
+                if (one == '"' || one == '\\') {
+                    out.Put('\\'), out.Put(char(one));
+                } else if (one < 0x20) {
+                    out.Put("\\u00");
+                    out.Put(hex[one >> 4]), out.Put(hex[one & 0xf]);
+                } else {
+                    out.Put(char(one));
+                }
+            }
+
+            out.Put("\"}\n");
+        }
+
+        void Binary(const TRow &row)
+        {
+            const TRecord rec = {
+                row.Used, row.Size, row.Alloc, row.Dirty, row.Wback, row.Evicted,
+                row.Margin, uint32_t(row.Depth), uint32_t(row.Path.size())
+            };
+
+            static const char zeroes[8] = { };
+
+            const size_t pad = NMisc::GranUp(row.Path.size(), 8) - row.Path.size();
+
+            out.Put(std::string_view(reinterpret_cast<const char*>(&rec), sizeof(rec)));
+            out.Put(row.Path);
+            out.Put(std::string_view(zeroes, pad));
+        }
+
+        EFormat     format  = FORMAT_HUMAN;
+        bool        sampled = false;
+        bool        extended = false;
+        bool        started = false;
+        TBuffer     out;
+    };
+}
@@ -0,0 +1,266 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "scan.h"
+
+namespace NPages {
+
+    /* Exact set of resident pages of a file, kept by chunks of 64K
+        pages as in roaring bitmaps. A chunk holds runs of pages while
+        they take less than its plain bitmap, thus the memory is never
+        above a bit per page of the file and sequential data is cheap.
+        Pages are added only in ascending order, as probe gives spans. */
+
+    class TPages {
+    public:
+        static constexpr size_t Span    = size_t(1) << 16;
+        static constexpr size_t Words   = Span / 64;
+        static constexpr size_t Most    = Words * 2;   /* runs of chunk */
+
+        struct TChunk {
+            void Reset(size_t key) noexcept
+            {
+                Key = key, Dense = false, Runs.clear();
+            }
+
+            void Add(size_t off, size_t len)
+            {
+                if (Dense) {
+                    Set(Bits.data(), off, len);
+
+                } else if (!Runs.empty() && After(Runs.back()) == off) {
+                    Runs.back() += len;
+
+                } else if (Runs.size() < Most) {
+                    Runs.push_back(uint32_t(off << 16 | (len - 1)));
+
+                } else {
+                    Bits.assign(Words, 0);
+
+                    Expand(Bits.data());
+
+                    Dense = true, Runs.clear();
+
+                    Set(Bits.data(), off, len);
+                }
+            }
+
+            void Expand(uint64_t *bits) const noexcept
+            {
+                if (Dense) {
+                    memcpy(bits, Bits.data(), Words * sizeof(uint64_t));
+                } else {
+                    memset(bits, 0, Words * sizeof(uint64_t));
+
+                    for (auto run : Runs) Set(bits, run >> 16, (run & 0xffff) + 1);
+                }
+            }
+
+            static size_t After(uint32_t run) noexcept
+            {
+                return (run >> 16) + (run & 0xffff) + 1;
+            }
+
+            static void Set(uint64_t *bits, size_t off, size_t len) noexcept
+            {
+                for (const size_t end = off + len; off < end; ) {
+                    const size_t pos = off % 64;
+                    const size_t take = std::min(64 - pos, end - off);
+
+                    bits[off / 64] |= (take == 64 ? ~0ull : ((1ull << take) - 1) << pos);
+
+                    off += take;
+                }
+            }
+
+            bool operator==(const TChunk &two) const noexcept
+            {
+                return Key == two.Key && Dense == two.Dense
+                        && (Dense ? Bits == two.Bits : Runs == two.Runs);
+            }
+
+            size_t                  Key     = 0;
+            bool                    Dense   = false;
+            std::vector<uint32_t>   Runs;   /* offset << 16 | pages - 1 */
+            std::vector<uint64_t>   Bits;
+        };
+
+        /* Chunks are kept for reuse, thus steady ticks do no allocation */
+
+        void Clear() noexcept { used = 0, count = 0; }
+
+        void Add(size_t at, size_t pages)
+        {
+            count += pages;
+
+            while (pages > 0) {
+                const size_t off = at % Span;
+                const size_t len = std::min(pages, Span - off);
+
+                Chunk(at / Span).Add(off, len);
+
+                at += len, pages -= len;
+            }
+        }
+
+        size_t Pages() const noexcept { return count; }
+
+        size_t Size() const noexcept { return used; }
+
+        const TChunk& operator[](size_t z) const noexcept { return chunks[z]; }
+
+    protected:
+        TChunk& Chunk(size_t key)
+        {
+            if (used == 0 || chunks[used - 1].Key != key) {
+                if (used == chunks.size()) chunks.emplace_back();
+
+                chunks[used++].Reset(key);
+            }
+
+            return chunks[used - 1];
+        }
+
+        size_t              used    = 0;
+        size_t              count   = 0;
+        std::vector<TChunk> chunks;
+    };
+
+    /* Resident runs of pages with prefix sums, it counts pages of any
+        window exactly by a binary search at each of its edges, thus a
+        map of any window at any width is built in time of the output,
+        without probing the file again. Runs are added in ascending order */
+
+    class TIndex {
+    public:
+        void Clear() noexcept { runs.clear(), total = 0; }
+
+        void Add(size_t at, size_t pages)
+        {
+            if (!runs.empty() && runs.back().After == at) {
+                runs.back().After += pages;
+            } else {
+                runs.push_back({ at, at + pages, total });
+            }
+
+            total += pages;
+        }
+
+        size_t Pages() const noexcept { return total; }
+
+        size_t Count(size_t from, size_t to) const noexcept
+        {
+            return to > from ? Below(to) - Below(from) : 0;
+        }
+
+        /* Resident pages before the page */
+
+        size_t Below(size_t page) const noexcept
+        {
+            auto it = std::upper_bound(runs.begin(), runs.end(), page,
+                        [](size_t at, const TRun &run) { return at < run.At; });
+
+            if (it == runs.begin()) return 0;
+
+            --it;
+
+            return it->Sum + std::min(page, it->After) - it->At;
+        }
+
+    protected:
+        struct TRun {
+            size_t  At;
+            size_t  After;
+            size_t  Sum;    /* resident pages before the run */
+        };
+
+        std::vector<TRun>   runs;
+        size_t              total   = 0;
+    };
+
+    /* Exact difference of two page sets, feed gets ranges of pages as
+        (at, pages, in) where in is true for pages which are loaded and
+        false for evicted ones. Ranges of the same kind crossing chunks
+        edges are joined. Equal chunks are skipped without expanding. */
+
+    class TDelta {
+    public:
+        TDelta() : one(TPages::Words), two(TPages::Words), diff(TPages::Words) { }
+
+        template<typename TFeed>
+        void operator()(const TPages &was, const TPages &now, TFeed &&feed)
+        {
+            size_t z = 0, y = 0;
+
+            TRange in{ 0, 0 }, out{ 0, 0 };
+
+            auto emit = [&](TRange &range, bool kind, size_t at, size_t pages) {
+                if (range.pages > 0 && range.at + range.pages == at) {
+                    range.pages += pages;
+                } else {
+                    if (range.pages > 0) feed(range.at, range.pages, kind);
+
+                    range = { at, pages };
+                }
+            };
+
+            while (z < was.Size() || y < now.Size()) {
+                const TPages::TChunk *a = z < was.Size() ? &was[z] : nullptr;
+                const TPages::TChunk *b = y < now.Size() ? &now[y] : nullptr;
+
+                if (a && b && a->Key != b->Key) {
+                    if (a->Key < b->Key) b = nullptr; else a = nullptr;
+                }
+
+                z += bool(a), y += bool(b);
+
+                if (a && b && *a == *b) continue;
+
+                const size_t key = a ? a->Key : b->Key;
+
+                if (a) a->Expand(one.data()); else Zero(one);
+                if (b) b->Expand(two.data()); else Zero(two);
+
+                const size_t base = key * TPages::Span;
+
+                for (size_t w = 0; w < TPages::Words; w++)
+                    diff[w] = two[w] & ~one[w];
+
+                NScan::Runs(diff.data(), TPages::Span, [&](size_t from, size_t to) {
+                    emit(in, true, base + from, to - from);
+                });
+
+                for (size_t w = 0; w < TPages::Words; w++)
+                    diff[w] = one[w] & ~two[w];
+
+                NScan::Runs(diff.data(), TPages::Span, [&](size_t from, size_t to) {
+                    emit(out, false, base + from, to - from);
+                });
+            }
+
+            if (in.pages > 0) feed(in.at, in.pages, true);
+            if (out.pages > 0) feed(out.at, out.pages, false);
+        }
+
+    protected:
+        struct TRange {
+            size_t  at;
+            size_t  pages;
+        };
+
+        static void Zero(std::vector<uint64_t> &bits) noexcept
+        {
+            std::fill(bits.begin(), bits.end(), 0);
+        }
+
+        std::vector<uint64_t>   one;
+        std::vector<uint64_t>   two;
+        std::vector<uint64_t>   diff;
+    };
+}
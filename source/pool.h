@@ -0,0 +1,115 @@
+#pragma once /*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#include <mutex>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace NUtils {
+
+    /* Fixed size pool of workers, each one owns a queue of tasks and
+        steals from the others when own queue is drained. Task gets
+        index of the worker, it may be used for per worker state.   */
+
+    class TPool {
+    public:
+        using TTask = std::function<void(size_t worker)>;
+
+        TPool(size_t threads) : queues(std::max(threads, size_t(1)))
+        {
+            for (size_t z = 0; z < queues.size(); z++) {
+                workers.emplace_back([this, z]() { Loop(z); });
+            }
+        }
+
+        TPool(const TPool&) = delete;
+
+        ~TPool()
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                stop = true;
+            }
+
+            wake.notify_all();
+
+            for (auto &worker : workers) worker.join();
+        }
+
+        size_t Size() const noexcept { return workers.size(); }
+
+        void Push(TTask task)
+        {
+            auto &queue = queues[next++ % queues.size()];
+
+            {
+                std::lock_guard<std::mutex> guard(queue.lock);
+
+                queue.tasks.push_back(std::move(task));
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                queued++;
+            }
+
+            wake.notify_one();
+        }
+
+    protected:
+        struct TQueue {
+            std::mutex          lock;
+            std::deque<TTask>   tasks;
+        };
+
+        void Loop(size_t worker) noexcept
+        {
+            for (TTask task; ; ) {
+                if (Take(worker, task)) {
+                    task(worker);
+                } else {
+                    std::unique_lock<std::mutex> guard(lock);
+
+                    wake.wait(guard, [this]() { return stop || queued > 0; });
+
+                    if (stop && queued <= 0) break;
+                }
+            }
+        }
+
+        bool Take(size_t worker, TTask &task) noexcept
+        {
+            for (size_t z = 0; z < queues.size(); z++) {
+                auto &queue = queues[(worker + z) % queues.size()];
+
+                std::lock_guard<std::mutex> guard(queue.lock);
+
+                if (!queue.tasks.empty()) {
+                    task = std::move(queue.tasks.front());
+
+                    queue.tasks.pop_front();
+
+                    queued--;
+
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        bool                        stop    = false;
+        std::atomic<long>           queued{ 0 };
+        size_t                      next    = 0;
+        std::mutex                  lock;
+        std::condition_variable     wake;
+        std::vector<TQueue>         queues;
+        std::vector<std::thread>    workers;
+    };
+}
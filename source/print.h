@@ -5,14 +5,18 @@
 #include <cassert>
 #include <iostream>
 #include <iomanip>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "humans.h"
 #include "parts.h"
+#include "pages.h"
 
 namespace NStats {
     class TPrint {
     public:
-        using TIter = TBands::TVec::const_iterator;
+        using TIter = NParts::TRange::const_iterator;
 
         TPrint(const TBands &bands_, size_t slots_ = 0) : bands(bands_)
         {
@@ -29,10 +33,14 @@ namespace NStats {
                 << "% [" << Dots(bands) << "] "
                 << NHumans::Value(((const TBand&)bands).Limit);
 
+            const TBand &all = bands;
+
+            if (all.Alloc < all.Limit) os << " a " << NHumans::Value(all.Alloc);
+
             return os;
         }
 
-        std::string Dots(const TBands::TVec &vec) const noexcept
+        std::string Dots(const TBands &bands) const noexcept
         {
             std::string dots;
 
@@ -40,25 +48,27 @@ namespace NStats {
 
             auto put = [&](size_t z, TIter at, TIter end)
             {
-                TBand aggr(0, 0);
-
-                for (; at != end; at++) {
-                    aggr.Limit += at->Limit;
-                    aggr.Value += at->Value;
-                }
-
-                const char syms[] = ".,~0123456789+";
-
-                dots.append(1, syms[Class_0_13(aggr)]);
+                dots.append(1, Syms[Class(bands.Sum(at, end))]);
             };
 
-            NParts::Equal<TBands::TVec>(vec, slots)(put);
+            const NParts::TRange range(bands.Size());
+
+            NParts::Equal<NParts::TRange>(range, slots)(put);
 
             assert(dots.size() == slots);
 
             return dots;
         }
 
+        static constexpr char Syms[] = ".,~0123456789+_";
+
+        /* Class of the band with holes, they are above of 0..13 */
+
+        static unsigned Class(const TBand &band) noexcept
+        {
+            return band.Hole() ? 14 : Class_0_13(band);
+        }
+
         static unsigned Class_0_13(const TBand &band) noexcept
         {
             if (band.Empty()) {
@@ -83,6 +93,85 @@ namespace NStats {
         const TBands    &bands;
     };
 
+    /* Window of a file as "off:len" in bytes, zero or missing length
+        is up to the end. It is rendered to width symbols of the same
+        classes as bands, each one by exact count of resident pages */
+
+    struct TWindow {
+        size_t      At      = 0;
+        size_t      Bytes   = 0;
+        unsigned    Width   = 0;
+
+        static bool Parse(const std::string &arg, TWindow &window) noexcept
+        {
+            const size_t colon = arg.find(':');
+
+            try {
+                window.At = std::stoull(arg.substr(0, colon));
+                window.Bytes = colon == std::string::npos
+                                ? 0 : std::stoull(arg.substr(colon + 1));
+            } catch (std::exception &) {
+                return false;
+            }
+
+            return true;
+        }
+
+        /* Pages of the window clipped to the file */
+
+        std::pair<size_t, size_t> Pages(size_t size, size_t page) const noexcept
+        {
+            const size_t last = NMisc::DivUp(size, page);
+            const size_t till = Bytes > 0 ? At + Bytes : size;
+
+            const size_t from = std::min(At / page, last);
+
+            return { from, std::max(from, std::min(NMisc::DivUp(till, page), last)) };
+        }
+
+        /* Pages of slots are allocated by the sorted data extents of
+            the file, slots without any of them are shown as holes  */
+
+        std::string Dots(const NPages::TIndex &index, size_t size, size_t page,
+                            const std::vector<NUtils::TSpan> &extents) const
+        {
+            const auto range = Pages(size, page);
+
+            const size_t pages = range.second - range.first;
+            const size_t slots = std::min<size_t>(Width, pages);
+
+            std::string dots;
+
+            dots.reserve(slots);
+
+            auto data = extents.begin();
+
+            for (size_t z = 0; z < slots; z++) {
+                const size_t from = range.first + pages * z / slots;
+                const size_t to = range.first + pages * (z + 1) / slots;
+
+                TBand band(from, to - from);
+
+                band.Value = index.Count(from, to);
+                band.Alloc = 0;
+
+                while (data != extents.end() && NMisc::DivUp(data->after(), page) <= from)
+                    data++;
+
+                for (auto it = data; it != extents.end() && it->at / page < to; it++) {
+                    const size_t at = std::max(it->at / page, from);
+                    const size_t end = std::min(NMisc::DivUp(it->after(), page), to);
+
+                    band.Alloc = std::min(band.Alloc + (end - at), band.Limit);
+                }
+
+                dots.append(1, TPrint::Syms[TPrint::Class(band)]);
+            }
+
+            return dots;
+        }
+    };
+
     std::ostream& operator<<(std::ostream &os, const TPrint &pr) noexcept
     {
         return pr(os);
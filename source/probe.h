@@ -6,6 +6,7 @@
 #include <sys/mman.h>
 
 #include <memory>
+#include <vector>
 #include <cstdint>
 #include <iostream>
 #include <algorithm>
@@ -13,26 +14,109 @@
 
 #include "error.h"
 #include "file.h"
+#include "misc.h"
+#include "scan.h"
 
 class TProbe {
 public:
     using TFunc = std::function<void(NUtils::TSpan&)>;
 
-    TProbe()
-        : items(64 * 1024)
+    TProbe(size_t window_ = Window)
+        : items(64 * 1024), window(window_)
     {
         array = array_t(new uint8_t[items]);
+        bits = bits_t(new uint64_t[items / 64]);
     }
 
-    void operator()(const NOs::TMemRg &mem, const TFunc &feed) const
+    /* Default size of mapping window for probing files by parts */
+
+    static constexpr size_t Window = size_t(1) << 30;
+
+    /* Feed is a template to get it inlined to the scan loop, any
+        callable with void(TSpan&) signature, TFunc is also fine  */
+
+    template<typename TFeed>
+    void operator()(const NOs::TMemRg &mem, TFeed &&feed) const
+    {
+        NUtils::TSpan accum(0, 0);
+
+        Scan(mem, 0, accum, feed);
+
+        if (accum) feed(accum);
+    }
+
+    /* Probes only the given data extents of the mapped file, they are
+        ascending, within the mapping and given in file offsets    */
+
+    template<typename TFeed>
+    void operator()(const NOs::TMemRg &mem,
+                        const std::vector<NUtils::TSpan> &extents, TFeed &&feed) const
+    {
+        const size_t gran = mem.gran();
+
+        NUtils::TSpan accum(0, 0);
+
+        size_t done = 0;    /* extents may share a page on small blocks */
+
+        for (auto &data : extents) {
+            const size_t at = std::max(NMisc::GranDown(data.at, gran), done);
+            const size_t end = std::min(data.after(), mem.bytes);
+
+            if (at >= end) continue;
+
+            const NOs::TMemRg part(gran, NUtils::TSpan(mem.at + at, end - at));
+
+            Scan(part, at, accum, feed);
+
+            done = NMisc::GranUp(end, gran);
+        }
+
+        if (accum) feed(accum);
+    }
+
+    /* Maps and probes data extents of file range by windows, each one
+        is unmapped before the next, so mapping cost does not depend
+        on size. Holes of sparse files are skipped without mincore(),
+        thus pages cached over holes, if any, are not reported.     */
+
+    template<typename TFeed>
+    void operator()(const NOs::TFile &file, const NUtils::TSpan &range,
+                        TFeed &&feed) const
+    {
+        const size_t gran = getpagesize();
+        const size_t step = NMisc::GranUp(std::max(window, gran), gran);
+
+        NUtils::TSpan accum(0, 0);
+
+        size_t done = 0;    /* extents may share a page on small blocks */
+
+        NOs::Extents(file, range, [&](const NUtils::TSpan &data) {
+            size_t at = std::max(NMisc::GranDown(data.at, gran), done);
+
+            for (; at < data.after(); at += step) {
+                const size_t bytes = std::min(step, data.after() - at);
+
+                NOs::TMapped map(file, NUtils::TSpan(at, bytes));
+
+                Scan(map, at, accum, feed);
+            }
+
+            done = std::max(done, NMisc::GranUp(data.after(), gran));
+        });
+
+        if (accum) feed(accum);
+    }
+
+protected:
+    template<typename TFeed>
+    void Scan(const NOs::TMemRg &mem, size_t base, NUtils::TSpan &accum,
+                TFeed &feed) const
     {
         const size_t gran = mem.gran();
 
         if (mem.paged() > 0) {
             char *it = mem;
 
-            NUtils::TSpan accum(0, 0);
-
             const size_t pages = mem.pages();
 
             for (size_t page = 0; page < pages; page += items) {
@@ -42,28 +126,30 @@ public:
                 if (mincore(it, bytes, array.get()) < 0 )
                     throw TError("error happens while mincore() invocation");
 
-                for (size_t z = 0; z < chunk; z++) {
-                    if (array[z] & 0x01) {
-                        NUtils::TSpan span((page + z) * gran, gran);
+                NScan::Pack(array.get(), chunk, bits.get());
+
+                const size_t at = base + page * gran;
+
+                NScan::Runs(bits.get(), chunk, [&](size_t from, size_t to) {
+                    NUtils::TSpan span(at + from * gran, (to - from) * gran);
 
-                        if (!accum.join(span)) {
-                            feed(accum);
+                    if (!accum.join(span)) {
+                        if (accum) feed(accum);
 
-                            accum = span;
-                        }
+                        accum = span;
                     }
-                }
+                });
 
                 it += bytes;
             }
-
-            if (accum) feed(accum);
         }
     }
 
-protected:
     using array_t = std::unique_ptr<uint8_t[]>;
+    using bits_t = std::unique_ptr<uint64_t[]>;
 
     size_t      items;
+    size_t      window;
     array_t     array;
+    bits_t      bits;
 };
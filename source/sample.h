@@ -0,0 +1,128 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "span.h"
+#include "file.h"
+#include "backend.h"
+
+namespace NProbe {
+
+    /* Estimated cached bytes with variance of the estimation, both
+        are additive for independent files, thus may be aggregated */
+
+    struct TEstimate {
+        double Margin(double z = 1.96) const noexcept {
+            return z * std::sqrt(Var);
+        }
+
+        double      Used    = 0;
+        double      Var     = 0;
+    };
+
+    /* Stratified sampler, pages of a file are split to budget equal
+        strata and a single random page of each one is probed. The
+        variance is of the Agresti-Coull interval for 95%, two hits and
+        two misses are added to the sample, thus the margin isn't zero
+        for files seen entirely cached or uncached by a few samples. */
+
+    class TSampler {
+    public:
+        static constexpr double Z2 = 1.96 * 1.96;
+
+        TSampler(size_t budget_, uint64_t seed) : budget(budget_), rnd(seed)
+        {
+            pages.reserve(budget);
+        }
+
+        explicit operator bool() const noexcept { return budget > 0; }
+
+        /* Whether the budget covers all pages, thus probe is exact */
+
+        bool Covers(const NUtils::TGran &all) const noexcept {
+            return all.pages() <= budget;
+        }
+
+        TEstimate operator()(IBackend &probe, const NOs::TFile &file,
+                                const NUtils::TGran &all)
+        {
+            const size_t total = all.pages();
+            const size_t num = std::min(budget, total);
+
+            pages.clear();
+
+            for (size_t z = 0; z < num; z++) {
+                const size_t at = z * total / num;
+                const size_t end = (z + 1) * total / num;
+
+                pages.push_back(at + rnd() % (end - at));
+            }
+
+            const size_t hits = probe.Hits(file, pages.data(), num);
+
+            const double share = double(hits) / num;
+            const double bytes = double(all.paged());
+            const double fpc = double(total - num) / std::max(total - 1, size_t(1));
+
+            const double wide = num + Z2;
+            const double mid = (hits + Z2 / 2) / wide;
+
+            TEstimate est;
+
+            est.Used = share * bytes;
+            est.Var = bytes * bytes * mid * (1 - mid) / wide * fpc;
+
+            return est;
+        }
+
+    protected:
+        size_t                  budget = 0;
+        std::mt19937_64         rnd;
+        std::vector<size_t>     pages;
+    };
+
+    /* Poisson sampling of files with chance proportional to the size,
+        files of unit bytes or larger are always taken. Estimate of a
+        taken file is weighted by the inverse chance as by Horvitz and
+        Thompson. Both terms of the variance are estimated from taken
+        files only, thus each one is weighted by the inverse chance
+        once more: sampling of pages by 1/chance^2 and the selection
+        by (1 - chance)/chance^2 of the file usage squared.        */
+
+    class TPicker {
+    public:
+        TPicker(size_t unit_, uint64_t seed) : unit(unit_), rnd(seed) { }
+
+        explicit operator bool() const noexcept { return unit > 0; }
+
+        double Chance(size_t bytes) const noexcept
+        {
+            return unit > 0 ? std::min(1., double(bytes) / unit) : 1.;
+        }
+
+        bool operator()(double chance) noexcept
+        {
+            return chance >= 1 || std::generate_canonical<double, 53>(rnd) < chance;
+        }
+
+        static TEstimate Weigh(const TEstimate &est, double chance) noexcept
+        {
+            if (chance >= 1) return est;
+
+            TEstimate out;
+
+            out.Used = est.Used / chance;
+            out.Var = est.Var / (chance * chance) + (1 - chance) * out.Used * out.Used;
+
+            return out;
+        }
+
+    protected:
+        size_t                  unit = 0;
+        std::mt19937_64         rnd;
+    };
+}
@@ -0,0 +1,137 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FINCORE_X86 1
+#endif
+
+namespace NScan {
+
+    /* Packs lowest bits of mincore() vector to bitmap, 64 pages per
+        word, bits behind the last page are zeroed. The vectorized
+        variant is selected once at runtime by the CPU features.   */
+
+    using TPack = void (*)(const uint8_t *vec, size_t items, uint64_t *bits);
+
+    inline void PackTail(const uint8_t *vec, size_t items, uint64_t *bits)
+    {
+        uint64_t word = 0;
+
+        for (size_t z = 0; z < items; z++) {
+            word |= uint64_t(vec[z] & 0x01) << z;
+        }
+
+        *bits = word;
+    }
+
+    inline void Pack_Plain(const uint8_t *vec, size_t items, uint64_t *bits)
+    {
+        for (; items >= 64; items -= 64, vec += 64) {
+            PackTail(vec, 64, bits++);
+        }
+
+        if (items > 0) PackTail(vec, items, bits);
+    }
+
+#ifdef FINCORE_X86
+
+    inline void Pack_SSE2(const uint8_t *vec, size_t items, uint64_t *bits)
+    {
+        for (; items >= 64; items -= 64, vec += 64) {
+            uint64_t word = 0;
+
+            for (size_t z = 0; z < 4; z++) {
+                auto v = _mm_loadu_si128((const __m128i*)(vec + z * 16));
+
+                /* moves page bit 0 of each byte to bit 7 for movemask */
+
+                v = _mm_slli_epi16(v, 7);
+
+                word |= uint64_t(uint32_t(_mm_movemask_epi8(v))) << (z * 16);
+            }
+
+            *bits++ = word;
+        }
+
+        if (items > 0) PackTail(vec, items, bits);
+    }
+
+    __attribute__((target("avx2")))
+    inline void Pack_AVX2(const uint8_t *vec, size_t items, uint64_t *bits)
+    {
+        for (; items >= 64; items -= 64, vec += 64) {
+            auto lo = _mm256_loadu_si256((const __m256i*)(vec));
+            auto hi = _mm256_loadu_si256((const __m256i*)(vec + 32));
+
+            lo = _mm256_slli_epi16(lo, 7);
+            hi = _mm256_slli_epi16(hi, 7);
+
+            *bits++ = uint64_t(uint32_t(_mm256_movemask_epi8(lo)))
+                    | uint64_t(uint32_t(_mm256_movemask_epi8(hi))) << 32;
+        }
+
+        if (items > 0) PackTail(vec, items, bits);
+    }
+
+#endif
+
+    inline TPack Select() noexcept
+    {
+#ifdef FINCORE_X86
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2")) {
+            return Pack_AVX2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            return Pack_SSE2;
+        }
+#endif
+        return Pack_Plain;
+    }
+
+    inline void Pack(const uint8_t *vec, size_t items, uint64_t *bits)
+    {
+        static const TPack impl = Select();
+
+        impl(vec, items, bits);
+    }
+
+    /* Calls feed(from, to) for each run of set bits [from, to), runs
+        are looked up by whole words, thus skipping 64 pages at once */
+
+    template<typename TFeed>
+    void Runs(const uint64_t *bits, size_t items, TFeed &&feed)
+    {
+        const size_t words = (items + 63) / 64;
+
+        bool   inrun = false;
+        size_t start = 0;
+
+        for (size_t w = 0; w < words; w++) {
+            const uint64_t word = bits[w];
+
+            for (unsigned pos = 0; pos < 64; ) {
+                const uint64_t mask = (inrun ? ~word : word) & (~0ull << pos);
+
+                if (mask == 0) break;
+
+                pos = __builtin_ctzll(mask);
+
+                if (inrun) {
+                    feed(start, w * 64 + pos);
+                } else {
+                    start = w * 64 + pos;
+                }
+
+                inrun = !inrun;
+            }
+        }
+
+        if (inrun) feed(start, items);
+    }
+}
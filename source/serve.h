@@ -0,0 +1,717 @@
+#pragma once /*__ GPL 3.0, 2020 Alexander Soloviev (no.friday@yandex.ru) */
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/inotify.h>
+
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <limits>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include "file.h"
+#include "walk.h"
+#include "tiny.h"
+#include "ticks.h"
+#include "decay.h"
+#include "backend.h"
+#include "top.h"
+
+class TMod_Serve {
+    using TClock = std::chrono::steady_clock;
+    using TPass = NDecay::TCfg<TClock::duration>;
+
+    /* Periodic rescans are stretched while all directories are watched */
+
+    static constexpr unsigned Stretch = 16;
+
+    struct TCfg {
+        std::string Root;
+        std::string Socket;     /* Unix socket for stats requests   */
+        std::string Text;       /* Prometheus textfile to refresh   */
+        unsigned Tick = 1000;   /* Scheduler tick, msecs            */
+        unsigned Period = 60;   /* Mean rescan period of file, secs */
+        unsigned Walk = 600;    /* Period of walks for new files    */
+        unsigned Chunk = 4096;  /* Walk entries to visit per tick   */
+        unsigned Count = 0;     /* Ticks to run, zero is forever    */
+        unsigned Limit = 16;    /* Top entries to publish           */
+        TTop::TCfg Stats;       /* Depth and reductor of entries    */
+        bool Notify = false;    /* Rescan files on inotify events   */
+        size_t Window = TProbe::Window;
+        NProbe::EKind Backend = NProbe::KIND_AUTO;
+    };
+
+    struct TItem {
+        std::string     Path;       /* relative to the root         */
+        uint64_t        Size = 0;
+        NProbe::TUsage  Usage;      /* bytes of the last probe      */
+        uint32_t        Uid = 0;    /* owner and mtime, for groups  */
+        time_t          Mtime = 0;
+        NDecay::TValue  Churn;      /* decayed bytes changed at probe */
+        TClock::time_point Last;
+        unsigned        Walk = 0;   /* generation where last seen   */
+        bool            Fresh = true;
+        bool            Dirty = false;  /* got events since probe   */
+    };
+
+    /* Published entry, a row reduced by TTop as for stats mode */
+
+    struct TLine {
+        uint64_t        Used    = 0;
+        uint64_t        Size    = 0;
+        uint64_t        Dirty   = 0;
+        uint64_t        Wback   = 0;
+        std::string     Path;
+    };
+
+public:
+    int Handle(int argc, char *argv[])
+    {
+        extern char *optarg;
+
+        TCfg cfg{ };
+
+        cfg.Stats.reduct = TTop::TCfg::REDUCT_TOP;
+
+        while (true) {
+            static const char opts[] = "f:u:o:d:p:r:c:l:b:w:R:D:n";
+
+            const int opt = getopt(argc, argv, opts);
+
+            if (opt < 0) break;
+
+            if (opt == 'f') {
+                cfg.Root = optarg;
+            } else if (opt == 'u') {
+                cfg.Socket = optarg;
+            } else if (opt == 'o') {
+                cfg.Text = optarg;
+            } else if (opt == 'd') {
+                cfg.Tick = std::max(10ul, std::stoul(optarg));
+            } else if (opt == 'p') {
+                cfg.Period = std::max(1ul, std::stoul(optarg));
+            } else if (opt == 'r') {
+                cfg.Walk = std::max(1ul, std::stoul(optarg));
+            } else if (opt == 'c') {
+                cfg.Count = std::stoul(optarg);
+            } else if (opt == 'l') {
+                cfg.Limit = std::stoul(optarg);
+            } else if (opt == 'w') {
+                cfg.Window = std::stoull(optarg);
+            } else if (opt == 'D') {
+                cfg.Stats.edge = std::stoul(optarg);
+            } else if (opt == 'R') {
+                if (!TTop::TCfg::Parse(optarg, cfg.Stats.reduct)) {
+                    std::cerr << "unknown reductor " << optarg << "\n";
+
+                    return 1;
+                }
+            } else if (opt == 'n') {
+                cfg.Notify = true;
+            } else if (opt == 'b') {
+                if (!NProbe::Parse(optarg, cfg.Backend)) {
+                    std::cerr << "unknown backend " << optarg << "\n";
+
+                    return 1;
+                }
+            }
+        }
+
+        if (cfg.Root.empty()) {
+            std::cerr << "path to directory is not given\n";
+
+            return 1;
+        } else if (cfg.Socket.empty() && cfg.Text.empty()) {
+            std::cerr << "neither socket -u nor textfile -o is given\n";
+
+            return 1;
+        }
+
+        cfg.Stats.limit = cfg.Limit;
+
+        cfg.Stats.validate();
+
+        return Run(cfg);
+    }
+
+    int Run(const TCfg &cfg)
+    {
+        probe = NProbe::Make(cfg.Backend, cfg.Window);
+        extended = probe->Extended();
+        reducer.reset(new TTop(cfg.Stats));
+
+        if (!cfg.Socket.empty()) Listen(cfg.Socket);
+
+        if (cfg.Notify && (notify = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+            throw TError("cannot create inotify instance");
+
+        struct sigaction act = { };
+
+        act.sa_handler = [](int) { Stop = 1; };
+
+        sigaction(SIGINT, &act, nullptr);
+        sigaction(SIGTERM, &act, nullptr);
+
+        NUtils::TTicks<> ticks(cfg.Tick, cfg.Count ? cfg.Count : Max<unsigned>());
+
+        while (!Stop && ticks()) {
+            const auto now = TClock::now();
+
+            Walk(cfg, now);
+            Events(cfg);
+            Scan(cfg, now);
+
+            used = ticks.used<std::chrono::duration<double>>().count();
+
+            Publish(cfg);
+        }
+
+        if (sock > -1) {
+            ::close(sock);
+            ::unlink(cfg.Socket.c_str());
+        }
+
+        if (notify > -1) ::close(notify);
+
+        return 0;
+    }
+
+protected:
+    /* The tree is walked incrementally, a chunk of entries per tick,
+        files which are not seen by the whole walk are forgotten. While
+        all directories are watched new files come by events, thus the
+        tree is walked again only on new directories or lost events  */
+
+    void Walk(const TCfg &cfg, TClock::time_point now)
+    {
+        if (!walk) {
+            const bool wait = now - walked < std::chrono::seconds(cfg.Walk);
+
+            if (walks > 0 && !rewalk && (wait || Watching())) return;
+
+            walk.reset(new NUtils::NDir::TWalk(cfg.Root));
+            walks++, walked = now, rewalk = false;
+
+            Watch(cfg, { });
+        }
+
+        for (unsigned left = cfg.Chunk; *walk && left > 0; left--) {
+            auto ref = walk->next();
+
+            if (ref.type == NOs::ENode::Dir) {
+                Watch(cfg, ref.path());
+            } else if (ref.type == NOs::ENode::File) {
+                Add(ref.path()).Walk = walks;
+            }
+        }
+
+        if (!*walk) {
+            walk.reset();
+
+            Forget();
+        }
+    }
+
+    TItem& Add(std::string path)
+    {
+        auto it = index.find(path);
+
+        if (it == index.end()) {
+            it = index.emplace(path, items.size()).first;
+            items.emplace_back();
+            items.back().Path = std::move(path);
+            items.back().Walk = walks;
+
+            changed = true;
+        }
+
+        return items[it->second];
+    }
+
+    void Drop(const std::string &path)
+    {
+        auto it = index.find(path);
+
+        if (it == index.end()) return;
+
+        const size_t z = it->second;
+
+        index.erase(it);
+
+        changed = true;
+
+        if (z + 1 < items.size()) {
+            items[z] = std::move(items.back());
+            index[items[z].Path] = z;
+        }
+
+        items.pop_back();
+    }
+
+    void Forget()
+    {
+        auto gone = [&](const TItem &item) { return item.Walk != walks; };
+
+        items.erase(std::remove_if(items.begin(), items.end(), gone), items.end());
+
+        changed = true;
+
+        index.clear();
+
+        for (size_t z = 0; z < items.size(); z++) index.emplace(items[z].Path, z);
+    }
+
+    /* Watches are kept for directories by the relative path. The
+        events are read once per tick, thus a file with a burst of
+        events is probed only once. Reads through mmap() and eviction
+        give no events, they are catched only by periodic rescans */
+
+    bool Watching() const noexcept
+    {
+        return notify > -1 && !overlimit;
+    }
+
+    void Watch(const TCfg &cfg, const std::string &path)
+    {
+        if (notify < 0) return;
+
+        const uint32_t mask = IN_ACCESS | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE
+                    | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF
+                    | IN_ONLYDIR;
+
+        const std::string full = path.empty() ? cfg.Root : cfg.Root + "/" + path;
+
+        const int wd = ::inotify_add_watch(notify, full.c_str(), mask);
+
+        if (wd > -1) {
+            watches[wd] = path;
+        } else if (!overlimit) {
+            overlimit = true;
+
+            std::cerr << "cannot watch " << full << ", errno " << errno << "\n";
+        }
+    }
+
+    void Events(const TCfg &cfg)
+    {
+        if (notify < 0) return;
+
+        alignas(struct inotify_event) char buf[64 * 1024];
+
+        while (true) {
+            const ssize_t got = ::read(notify, buf, sizeof(buf));
+
+            if (got <= 0) break;
+
+            for (ssize_t off = 0; off < got; ) {
+                const auto *ev = reinterpret_cast<const struct inotify_event*>(buf + off);
+
+                off += sizeof(struct inotify_event) + ev->len;
+
+                if (ev->mask & IN_Q_OVERFLOW) {
+                    for (auto &item : items) item.Dirty = true;
+
+                    rewalk = true;
+                } else if (ev->mask & IN_IGNORED) {
+                    watches.erase(ev->wd);
+                } else if (ev->len > 0) {
+                    auto it = watches.find(ev->wd);
+
+                    if (it != watches.end()) Event(cfg, it->second, ev);
+                }
+            }
+        }
+    }
+
+    void Event(const TCfg &cfg, const std::string &dir, const struct inotify_event *ev)
+    {
+        const std::string path = dir.empty() ? ev->name : dir + "/" + ev->name;
+
+        if (ev->mask & IN_ISDIR) {
+            /* new subtree may already have files, so it is walked */
+
+            if (ev->mask & (IN_CREATE | IN_MOVED_TO)) rewalk = true;
+
+            if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) Prune(path);
+
+        } else if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            Drop(path);
+        } else if (index.count(path) || Regular(cfg, path)) {
+            Add(path).Dirty = true;
+        }
+    }
+
+    /* Only regular files are traced, open() of FIFO would block */
+
+    static bool Regular(const TCfg &cfg, const std::string &path)
+    {
+        return NOs::TStat(cfg.Root + "/" + path).Type == NOs::ENode::File;
+    }
+
+    /* Directory moved out of the tree gives no more events for its
+        files and walks are suspended under watches, thus all of the
+        files and watches below it are dropped at once            */
+
+    void Prune(const std::string &dir)
+    {
+        auto under = [&](const std::string &path) {
+            return path.size() > dir.size() && path[dir.size()] == '/'
+                        && path.compare(0, dir.size(), dir) == 0;
+        };
+
+        auto gone = [&](const TItem &item) { return under(item.Path); };
+
+        items.erase(std::remove_if(items.begin(), items.end(), gone), items.end());
+
+        changed = true;
+
+        index.clear();
+
+        for (size_t z = 0; z < items.size(); z++) index.emplace(items[z].Path, z);
+
+        for (auto it = watches.begin(); it != watches.end(); ) {
+            if (it->second == dir || under(it->second)) {
+                ::inotify_rm_watch(notify, it->first);
+
+                it = watches.erase(it);
+            } else {
+                it++;
+            }
+        }
+    }
+
+    /* Each file wants to be probed once per period divided by its
+        weight, larger and faster changing files have more weight.
+        The tick budget is the share of all wanted bytes for a tick.
+        Files with events go first, but each one at most once per the
+        period, thus a file read all the time isn't probed every tick.
+        With watches the periodic rescans only catch reads by mmap()
+        and evictions which give no events, they are stretched.    */
+
+    void Scan(const TCfg &cfg, TClock::time_point now)
+    {
+        const double mean = items.empty() ? 0. : double(total) / items.size();
+        const double period = double(cfg.Period) * (Watching() ? Stretch : 1);
+
+        double want = 0;
+
+        order.clear();
+
+        for (size_t z = 0; z < items.size(); z++) {
+            const auto &item = items[z];
+
+            const double weight = Weight(item, mean);
+
+            want += weight * item.Size;
+
+            const std::chrono::duration<double> age = now - item.Last;
+
+            if (item.Fresh || (item.Dirty && age.count() >= cfg.Period)) {
+                order.emplace_back(std::numeric_limits<double>::infinity(), z);
+            } else {
+                const double score = age.count() * weight / period;
+
+                if (score >= 1.) order.emplace_back(score, z);
+            }
+        }
+
+        std::sort(order.begin(), order.end(), std::greater<>());
+
+        const double budget = want * cfg.Tick / 1000. / cfg.Period;
+
+        double spent = 0;
+
+        /* Fresh files have unknown size and are out of the budget, they
+            come by walk chunks and thus are limited per tick anyway.
+            Files with events are charged, those left wait dirty    */
+
+        for (auto &one : order) {
+            auto &item = items[one.second];
+
+            if (!item.Fresh) {
+                if (spent > 0 && spent + item.Size > budget) break;
+
+                spent += std::max(item.Size, uint64_t(1));
+            }
+
+            Probe(cfg, item, now);
+        }
+
+        total = 0;
+
+        for (auto &item : items) total += item.Size;
+    }
+
+    static double Weight(const TItem &item, double mean) noexcept
+    {
+        if (item.Size == 0 || mean <= 0) return 1.;
+
+        const double churn = std::min(1., double(item.Churn) / item.Size);
+
+        return 1. + 8. * churn + std::log2(1. + item.Size / mean);
+    }
+
+    void Probe(const TCfg &cfg, TItem &item, TClock::time_point now)
+    {
+        NProbe::TUsage usage;
+
+        try {
+            if (!Regular(cfg, item.Path)) throw TError("not a regular file");
+
+            NOs::TFile file(cfg.Root + "/" + item.Path);
+
+            const NOs::TStat info(file);
+
+            const NUtils::TGran all(getpagesize(), NUtils::TSpan(0, info.Bytes));
+
+            item.Size = all.bytes;
+            item.Uid = info.Uid, item.Mtime = info.Mtime;
+
+            if (all.bytes > 0) {
+                usage = probe->Count(file, all);
+
+                usage.Cached    *= all.gran();
+                usage.Dirty     *= all.gran();
+                usage.Writeback *= all.gran();
+                usage.Evicted   *= all.gran();
+            }
+
+            probed += all.bytes;
+
+        } catch (TError &error) {
+            item.Size = 0;  /* it will be forgotten by the next walk */
+        }
+
+        const auto delta = ssize_t(usage.Cached) - ssize_t(item.Usage.Cached);
+
+        if (!item.Fresh) {
+            const double pass = TPass(std::chrono::seconds(cfg.Period))(now - item.Last);
+
+            item.Churn(pass, std::abs(delta));
+        }
+
+        item.Usage = usage, item.Last = now, item.Fresh = item.Dirty = false;
+
+        changed = true;
+    }
+
+    /* Entries are reduced again only after any probe or change of
+        the set of files, a quiet tree costs no work per tick      */
+
+    void Publish(const TCfg &cfg)
+    {
+        if (std::exchange(changed, false)) Reduce();
+
+        if (sock > -1) Answer();
+
+        if (!cfg.Text.empty()) Export(cfg.Text);
+    }
+
+    /* Entries are reduced by TTop as by stats mode, thus the same top,
+        depth and groups views are published. Labels are views to paths
+        of items, only entries kept by reductors take copies of them */
+
+    void Reduce()
+    {
+        using NUtils::NDir::Ref;
+
+        sum = NProbe::TUsage();
+
+        entries.clear();
+
+        for (auto &item : items) {
+            sum += item.Usage;
+
+            const unsigned depth = 1 + std::count(item.Path.begin(), item.Path.end(), '/');
+
+            TTop::TEntry entry(item.Size, item.Usage.Cached,
+                                Ref::View(NOs::ENode::File, depth, item.Path, { }));
+
+            entry.Dirty     = item.Usage.Dirty;
+            entry.Wback     = item.Usage.Writeback;
+            entry.Evicted   = item.Usage.Evicted;
+            entry.Uid       = item.Uid;
+            entry.Mtime     = item.Mtime;
+
+            entries.push_back(std::move(entry));
+        }
+
+        lines.clear();
+
+        reducer->Reduce(entries, [&](const NOutput::TRow &row) {
+            lines.push_back({ row.Used, row.Size, row.Dirty, row.Wback, std::string(row.Path) });
+        });
+    }
+
+    void Listen(const std::string &path)
+    {
+        struct sockaddr_un addr = { };
+
+        if (path.size() >= sizeof(addr.sun_path))
+            throw TError("socket path is too long");
+
+        addr.sun_family = AF_UNIX;
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        if (sock < 0) throw TError("cannot create unix socket");
+
+        ::unlink(path.c_str());
+
+        if (::bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+            throw TError("cannot bind unix socket");
+
+        if (::listen(sock, 16) < 0)
+            throw TError("cannot listen unix socket");
+    }
+
+    /* Clients are served once per tick, each one gets the summary
+        and top entries as lines of bytes: cached size dirty wback */
+
+    void Answer()
+    {
+        int fd = ::accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+
+        if (fd < 0) return;
+
+        std::string text;
+
+        auto line = [&](const TLine &one) {
+            text += std::to_string(one.Used) + " " + std::to_string(one.Size) + " "
+                    + std::to_string(one.Dirty) + " " + std::to_string(one.Wback)
+                    + " " + one.Path + "\n";
+        };
+
+        line({ sum.Cached, total, sum.Dirty, sum.Writeback, ":summary" });
+
+        for (auto &one : lines) line(one);
+
+        for (; fd > -1; fd = ::accept4(sock, nullptr, nullptr, SOCK_CLOEXEC)) {
+            const struct timeval wait = { 1, 0 };
+
+            ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait));
+
+            for (size_t off = 0; off < text.size(); ) {
+                const ssize_t got = ::send(fd, text.data() + off, text.size() - off,
+                                            MSG_NOSIGNAL);
+
+                if (got <= 0) break;
+
+                off += got;
+            }
+
+            ::close(fd);
+        }
+    }
+
+    void Export(const std::string &path)
+    {
+        const std::string temp = path + ".tmp";
+
+        {
+            std::ofstream out(temp, std::ios::trunc);
+
+            auto gauge = [&](const char *name, const char *help) {
+                out << "# HELP fincore_" << name << " " << help << "\n"
+                    << "# TYPE fincore_" << name << " gauge\n";
+            };
+
+            auto each = [&](const char *name, auto &&value) {
+                for (auto &one : lines) {
+                    out << "fincore_" << name << "{path=\"" << Escape(one.Path)
+                        << "\"} " << value(one) << "\n";
+                }
+            };
+
+            gauge("cached_bytes", "Cached bytes of top entries");
+            each("cached_bytes", [](const TLine &one) { return one.Used; });
+
+            gauge("size_bytes", "Size of top entries");
+            each("size_bytes", [](const TLine &one) { return one.Size; });
+
+            if (extended) {
+                gauge("dirty_bytes", "Dirty bytes of top entries");
+                each("dirty_bytes", [](const TLine &one) { return one.Dirty; });
+
+                gauge("writeback_bytes", "Writeback bytes of top entries");
+                each("writeback_bytes", [](const TLine &one) { return one.Wback; });
+            }
+
+            gauge("total_cached_bytes", "Cached bytes of all files");
+            out << "fincore_total_cached_bytes " << sum.Cached << "\n";
+
+            gauge("total_size_bytes", "Size of all files");
+            out << "fincore_total_size_bytes " << total << "\n";
+
+            gauge("files", "Number of known files");
+            out << "fincore_files " << items.size() << "\n";
+
+            gauge("tick_used_seconds", "Decayed time spent per tick");
+            out << "fincore_tick_used_seconds " << used << "\n";
+
+            out << "# HELP fincore_probed_bytes_total Bytes of files probed\n"
+                << "# TYPE fincore_probed_bytes_total counter\n"
+                << "fincore_probed_bytes_total " << probed << "\n";
+
+            if (!out.flush()) {
+                std::cerr << "cannot write textfile " << temp << "\n";
+
+                return;
+            }
+        }
+
+        if (::rename(temp.c_str(), path.c_str()) < 0)
+            std::cerr << "cannot rename textfile " << temp << "\n";
+    }
+
+    static std::string Escape(const std::string &value)
+    {
+        std::string out;
+
+        for (char c : value) {
+            if (c == '\\' || c == '"') {
+                out += '\\', out += c;
+            } else if (c == '\n') {
+                out += "\\n";
+            } else {
+                out += c;
+            }
+        }
+
+        return out;
+    }
+
+    static inline volatile sig_atomic_t Stop = 0;
+
+    NProbe::TBackend        probe;
+    bool                    extended = false;
+    int                     sock    = -1;
+    int                     notify  = -1;
+    bool                    rewalk  = false;
+    bool                    overlimit = false;
+    std::unordered_map<int, std::string> watches;
+    unsigned                walks   = 0;
+    TClock::time_point      walked;
+    TBox<NUtils::NDir::TWalk> walk;
+    std::vector<TItem>      items;
+    std::unordered_map<std::string, size_t> index;
+    std::vector<std::pair<double, size_t>> order;
+    TBox<TTop>              reducer;
+    std::vector<TTop::TEntry> entries;
+    std::vector<TLine>      lines;
+    NProbe::TUsage          sum;    /* of all files when reduced    */
+    bool                    changed = true;
+    uint64_t                total   = 0;
+    uint64_t                probed  = 0;
+    double                  used    = 0;
+};
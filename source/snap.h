@@ -0,0 +1,415 @@
+#pragma once /*__ GPL 3.0, 2020 Alexander Soloviev (no.friday@yandex.ru) */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include <ctime>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+#include "error.h"
+#include "file.h"
+#include "span.h"
+#include "misc.h"
+
+namespace NSnap {
+
+    /* Residency snapshot file: header and a sequence of 8 bytes
+        aligned records, each one is a fixed part, path and runs of
+        cached pages. Runs are encoded as LEB128 pairs of gap from
+        the end of the previous run and length, both in pages. The
+        file is read through mmap() without any copying of data.
+        Records of version 2 are sorted by path, thus two snapshots
+        are compared by a merge of both streams in a single pass. */
+
+    struct THead {
+        char        Magic[8];
+        uint32_t    Version;
+        uint32_t    Page;
+        uint64_t    Stamp;
+    };
+
+    struct TRec {
+        uint64_t    Size;       /* logical size of file in bytes    */
+        uint64_t    Dev;
+        uint64_t    Ino;
+        uint32_t    Path;       /* bytes of path following record   */
+        uint32_t    Runs;       /* number of encoded runs           */
+        uint64_t    Bytes;      /* bytes of encoded runs after path */
+    };
+
+    static constexpr char Magic[8] = { 'F', 'I', 'N', 'C', 'S', 'N', 'P', '1' };
+
+    static constexpr uint32_t Version = 2;     /* 1 is not sorted */
+
+    static_assert(sizeof(THead) == 24, "snapshot header layout");
+    static_assert(sizeof(TRec) == 40, "snapshot record layout");
+
+    /* Cached pages run, page numbers from the file start */
+
+    struct TRun {
+        uint64_t    At      = 0;
+        uint64_t    Pages   = 0;
+
+        uint64_t After() const noexcept { return At + Pages; }
+    };
+
+    class TRuns {
+    public:
+        TRuns(const uint8_t *at_, size_t bytes, size_t count_)
+            : at(at_), end(at_ + bytes), count(count_) { }
+
+        explicit operator bool() const noexcept { return count > 0; }
+
+        TRun next()
+        {
+            TRun run;
+
+            run.At = last + Take();
+            run.Pages = Take();
+
+            last = run.After(), count--;
+
+            return run;
+        }
+
+    protected:
+        uint64_t Take()
+        {
+            uint64_t value = 0;
+
+            for (unsigned shift = 0; ; shift += 7) {
+                if (at >= end || shift > 63)
+                    throw TError("corrupted runs in snapshot");
+
+                const uint8_t byte = *at++;
+
+                value |= uint64_t(byte & 0x7f) << shift;
+
+                if (!(byte & 0x80)) return value;
+            }
+        }
+
+        const uint8_t   *at     = nullptr;
+        const uint8_t   *end    = nullptr;
+        size_t          count   = 0;
+        uint64_t        last    = 0;
+    };
+
+    struct TItem {
+        TRuns Runs() const noexcept { return { runs, Rec->Bytes, Rec->Runs }; }
+
+        NOs::TLoc Loc() const noexcept { return { dev_t(Rec->Dev), ino_t(Rec->Ino) }; }
+
+        const TRec          *Rec    = nullptr;
+        std::string_view    Path;
+        const uint8_t       *runs   = nullptr;
+    };
+
+    class TWriter {
+    public:
+        TWriter(const std::string &path_) : path(path_), temp(path_ + ".tmp")
+        {
+            const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+            if ((fd = ::open(temp.c_str(), flags, 0644)) < 0)
+                throw TError("cannot create snapshot file");
+
+            THead head;
+
+            memcpy(head.Magic, Magic, sizeof(Magic));
+
+            head.Version = Version;
+            head.Page = getpagesize();
+            head.Stamp = time(nullptr);
+
+            Put(&head, sizeof(head));
+        }
+
+        TWriter(const TWriter&) = delete;
+
+        ~TWriter()
+        {
+            if (fd > -1) {
+                ::close(fd);
+                ::unlink(temp.c_str());
+            }
+        }
+
+        /* Spans are in bytes, ascending and not overlapped */
+
+        void Add(const std::string &name, uint64_t size, const NOs::TLoc &loc,
+                    const std::vector<NUtils::TSpan> &spans)
+        {
+            const size_t page = getpagesize();
+
+            if (sorted && added++ > 0 && name < last) sorted = false;
+
+            if (sorted) last = name;
+
+            runs.clear();
+
+            uint64_t last = 0;
+
+            for (auto &span : spans) {
+                const uint64_t at = span.at / page;
+
+                Code(at - last);
+                Code(NMisc::DivUp(span.bytes, page));
+
+                last = at + NMisc::DivUp(span.bytes, page);
+            }
+
+            TRec rec;
+
+            rec.Size = size;
+            rec.Dev = loc.Dev;
+            rec.Ino = loc.Ino;
+            rec.Path = name.size();
+            rec.Runs = spans.size();
+            rec.Bytes = runs.size();
+
+            Put(&rec, sizeof(rec));
+            Put(name.data(), name.size());
+            Put(runs.data(), runs.size());
+
+            const size_t pad = NMisc::GranUp(name.size() + runs.size(), 8)
+                                    - (name.size() + runs.size());
+
+            static const char zeroes[8] = { };
+
+            Put(zeroes, pad);
+        }
+
+        /* Flushes data and atomically replaces the target file, the
+            records are rewritten in order of paths if not added so */
+
+        void Close()
+        {
+            Flush();
+
+            if (!sorted) Sort();
+
+            if (::fsync(fd) < 0 || ::close(std::exchange(fd, -1)) < 0)
+                throw TError("cannot write snapshot file");
+
+            if (::rename(temp.c_str(), path.c_str()) < 0)
+                throw TError("cannot rename snapshot file");
+        }
+
+    protected:
+        void Sort();
+
+        void Code(uint64_t value)
+        {
+            for (; value >= 0x80; value >>= 7) {
+                runs.push_back(uint8_t(value) | 0x80);
+            }
+
+            runs.push_back(uint8_t(value));
+        }
+
+        void Put(const void *data, size_t bytes)
+        {
+            if (buf.size() + bytes > Buffer) Flush();
+
+            const char *at = static_cast<const char*>(data);
+
+            buf.insert(buf.end(), at, at + bytes);
+        }
+
+        void Flush()
+        {
+            for (size_t off = 0; off < buf.size(); ) {
+                const ssize_t got = ::write(fd, buf.data() + off, buf.size() - off);
+
+                if (got < 0 && errno == EINTR) continue;
+
+                if (got <= 0)
+                    throw TError("cannot write snapshot file");
+
+                off += got;
+            }
+
+            buf.clear();
+        }
+
+        static constexpr size_t Buffer = 1024 * 1024;
+
+        bool                    sorted  = true;
+        size_t                  added   = 0;
+        std::string             last;   /* path of the last record  */
+        int                     fd      = -1;
+        std::string             path;
+        std::string             temp;
+        std::vector<char>       buf;
+        std::vector<uint8_t>    runs;
+    };
+
+    class TReader {
+    public:
+        TReader(const std::string &path)
+        {
+            NOs::TFile file(path);
+
+            bytes = NOs::TStat(file).Bytes;
+
+            if (bytes < sizeof(THead))
+                throw TError("snapshot file is too short");
+
+            map = NOs::TMapped(file, NUtils::TSpan(0, bytes));
+
+            base = static_cast<const uint8_t*>(*map);
+
+            if (memcmp(Head().Magic, Magic, sizeof(Magic)) != 0)
+                throw TError("not a snapshot file");
+
+            if (Head().Version < 1 || Head().Version > Version)
+                throw TError("unknown snapshot version");
+
+            ::madvise(*map, bytes, MADV_SEQUENTIAL);
+        }
+
+        const THead& Head() const noexcept {
+            return *reinterpret_cast<const THead*>(base);
+        }
+
+        bool Sorted() const noexcept { return Head().Version >= 2; }
+
+        /* Records are iterated by offsets, offset of the first one is
+            zero and zero offset is returned after the last record  */
+
+        size_t next(size_t off, TItem &item) const
+        {
+            if (off == 0) off = sizeof(THead);
+
+            if (off + sizeof(TRec) > bytes) return 0;
+
+            item.Rec = reinterpret_cast<const TRec*>(base + off);
+
+            const size_t tail = item.Rec->Path + item.Rec->Bytes;
+
+            if (off + sizeof(TRec) + tail > bytes)
+                throw TError("truncated snapshot record");
+
+            auto *path = reinterpret_cast<const char*>(base + off + sizeof(TRec));
+
+            item.Path = std::string_view(path, item.Rec->Path);
+            item.runs = base + off + sizeof(TRec) + item.Rec->Path;
+
+            return off + sizeof(TRec) + NMisc::GranUp(tail, 8);
+        }
+
+        template<typename TFunc> void Each(TFunc &&func) const
+        {
+            TItem item;
+
+            for (size_t off = next(0, item); off; off = next(off, item)) {
+                func(item);
+            }
+        }
+
+        /* Offsets of all records in order of their paths */
+
+        std::vector<size_t> Order() const
+        {
+            std::vector<size_t> offs;
+
+            TItem item;
+
+            for (size_t off = sizeof(THead), end; (end = next(off, item)); off = end)
+                offs.push_back(off);
+
+            std::sort(offs.begin(), offs.end(), [this](size_t one, size_t two) {
+                TItem a, b;
+
+                return next(one, a), next(two, b), a.Path < b.Path;
+            });
+
+            return offs;
+        }
+
+    protected:
+        size_t              bytes   = 0;
+        const uint8_t       *base   = nullptr;
+        NOs::TMapped        map;
+    };
+
+    /* Records of the snapshot in order of paths, sorted snapshots are
+        streamed as is, only offsets of records are sorted for others */
+
+    class TCursor {
+    public:
+        TCursor(const TReader &reader_) : reader(reader_)
+        {
+            if (!reader.Sorted()) offs = reader.Order(), ordered = true;
+        }
+
+        bool next(TItem &item)
+        {
+            if (ordered) {
+                if (at >= offs.size()) return false;
+
+                return reader.next(offs[at++], item), true;
+            }
+
+            off = reader.next(off, item);
+
+            return off != 0;
+        }
+
+    protected:
+        const TReader       &reader;
+        bool                ordered = false;
+        size_t              off     = 0;
+        size_t              at      = 0;
+        std::vector<size_t> offs;
+    };
+
+    /* Records written in other order are sorted by offsets in the
+        temporary file and copied to a new one, the old one is removed */
+
+    inline void TWriter::Sort()
+    {
+        const std::string from = temp;
+
+        std::vector<size_t> offs;
+
+        {
+            const TReader reader(from);
+
+            offs = reader.Order();
+
+            temp = path + ".sort.tmp";
+
+            const int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+            const int to = ::open(temp.c_str(), flags, 0644);
+
+            if (to < 0) {
+                temp = from;
+
+                throw TError("cannot create snapshot file");
+            }
+
+            ::close(std::exchange(fd, to));
+            ::unlink(from.c_str());
+
+            Put(&reader.Head(), sizeof(THead));
+
+            TItem item;
+
+            for (size_t off : offs) {
+                const size_t end = reader.next(off, item);
+
+                Put(item.Rec, end - off);
+            }
+        }
+
+        Flush();
+    }
+}
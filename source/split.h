@@ -0,0 +1,122 @@
+/*__ GPL 3.0, 2019 Alexander Soloviev (no.friday@yandex.ru) */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <string>
+#include <condition_variable>
+
+#include "error.h"
+#include "file.h"
+#include "probe.h"
+#include "pool.h"
+
+/* Probes a single file by window sized chunks on a pool of threads.
+    Chunks are taken by waves, spans of each one are collected and
+    then merged in order with joining runs at chunk edges, thus feed
+    sees exactly the same runs as a serial TProbe would produce.    */
+
+class TSplit {
+public:
+    TSplit(size_t threads, size_t window_ = TProbe::Window)
+        : window(window_), pool(threads)
+    {
+        for (size_t z = 0; z < pool.Size(); z++)
+            probes.emplace_back(window);
+
+        parts.resize(pool.Size() * 2);
+    }
+
+    template<typename TFeed>
+    void operator()(const NOs::TFile &file, const NUtils::TSpan &range,
+                        TFeed &&feed)
+    {
+        const size_t gran = getpagesize();
+        const size_t step = NMisc::GranUp(std::max(window, gran), gran);
+
+        NUtils::TSpan accum(0, 0);
+
+        size_t at = NMisc::GranDown(range.at, gran);
+
+        while (at < range.after()) {
+            size_t wave = 0;
+
+            for (; wave < parts.size() && at < range.after(); wave++) {
+                const size_t bytes = std::min(step, range.after() - at);
+
+                Submit(file, parts[wave], NUtils::TSpan(at, bytes));
+
+                at += bytes;
+            }
+
+            Wait();
+
+            for (size_t z = 0; z < wave; z++) {
+                if (!parts[z].error.empty())
+                    throw TError(parts[z].error);
+
+                for (auto &span : parts[z].spans) {
+                    if (!accum.join(span)) {
+                        if (accum) feed(accum);
+
+                        accum = span;
+                    }
+                }
+            }
+        }
+
+        if (accum) feed(accum);
+    }
+
+protected:
+    struct TPart {
+        std::vector<NUtils::TSpan>  spans;
+        std::string                 error;
+    };
+
+    void Submit(const NOs::TFile &file, TPart &part, NUtils::TSpan span)
+    {
+        part.spans.clear();
+        part.error.clear();
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            pending++;
+        }
+
+        pool.Push([this, &file, &part, span](size_t worker) {
+            try {
+                probes[worker](file, span, [&](NUtils::TSpan &run) {
+                    part.spans.push_back(run);
+                });
+            } catch (TError &error) {
+                part.error = error.what();
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                pending--;
+            }
+
+            done.notify_one();
+        });
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        done.wait(guard, [this]() { return pending == 0; });
+    }
+
+    size_t                  window  = 0;
+    size_t                  pending = 0;
+    std::mutex              lock;
+    std::condition_variable done;
+    std::vector<TProbe>     probes;
+    std::vector<TPart>      parts;
+    NUtils::TPool           pool;
+};
@@ -2,33 +2,96 @@
 
 #pragma once
 
-#include <map>
+#include <ctime>
+#include <string>
+#include <vector>
 #include <memory>
+#include <new>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include "walk.h"
-#include "probe.h"
+#include "pool.h"
+#include "backend.h"
+#include "sample.h"
+#include "links.h"
+#include "snap.h"
 #include "humans.h"
+#include "output.h"
 
 class TTop {
 public:
     struct TCfg {
         enum EReduct {
             REDUCT_NONE     = 0,
-            REDUCT_TOP      = 1
+            REDUCT_TOP      = 1,
+            REDUCT_EXT      = 2,    /* groups by file extension     */
+            REDUCT_PREFIX   = 3,    /* by path prefix of depth      */
+            REDUCT_UID      = 4,    /* by owner of file             */
+            REDUCT_AGE      = 5,    /* by mtime age bucket          */
         };
 
+        enum ELinks {
+            LINKS_ALL       = 0,    /* every hardlink is a new file */
+            LINKS_FIRST     = 1,    /* charge inode to first path   */
+            LINKS_EVERY     = 2,    /* to each path, summary once   */
+        };
+
+        static bool Parse(const std::string &name, EReduct &reduct) noexcept
+        {
+            static const std::pair<const char*, EReduct> names[] = {
+                { "none", REDUCT_NONE },
+                { "top", REDUCT_TOP },
+                { "ext", REDUCT_EXT },
+                { "prefix", REDUCT_PREFIX },
+                { "uid", REDUCT_UID },
+                { "age", REDUCT_AGE },
+            };
+
+            for (auto &one : names) {
+                if (name == one.first) return reduct = one.second, true;
+            }
+
+            return false;
+        }
+
         const TCfg& validate()
         {
             raito = std::min(1., std::max(0., raito));
 
+            /* Groups are made of files, the depth is used for prefix */
+
+            if (reduct >= REDUCT_EXT) {
+                if (edge != unsigned(-1)) prefix = edge;
+
+                edge = -1;
+            }
+
             return *this;
         }
 
+        bool sampled() const noexcept { return sample > 0 || files > 0; }
+
         unsigned    edge    = -1;
         bool        zeroes  = false;
         bool        summary = false;
         EReduct     reduct  = REDUCT_NONE;
         unsigned    limit   = 16;
+        unsigned    prefix  = 1;    /* components of prefix group   */
         double      raito   = 0.;
+        unsigned    threads = 0;    /* zero for serial probing      */
+        bool        extend  = false;
+        NProbe::EKind backend = NProbe::KIND_AUTO;
+        size_t      window  = TProbe::Window;
+        size_t      sample  = 0;    /* pages per file, zero is exact */
+        size_t      files   = 0;    /* bytes per sure taken file    */
+        ELinks      links   = LINKS_ALL;
+        size_t      inodes  = 1024 * 1024;  /* hardlinked to track */
+        std::string snapshot;   /* write residency to the file  */
+        NOutput::EFormat format = NOutput::FORMAT_HUMAN;
     };
 
     class TEntry {
@@ -61,8 +124,18 @@ public:
         {
             assert(Label.depth < rval.Label.depth);
 
+            return Merge(rval);
+        }
+
+        TEntry& Merge(const TEntry &rval) noexcept
+        {
             Used    += rval.Used;
             Size    += rval.Size;
+            Alloc   += rval.Alloc;
+            Dirty   += rval.Dirty;
+            Wback   += rval.Wback;
+            Evicted += rval.Evicted;
+            Var     += rval.Var;
 
             return *this;
         }
@@ -73,6 +146,13 @@ public:
 
             swap(Used, rval.Used);
             swap(Size, rval.Size);
+            swap(Alloc, rval.Alloc);
+            swap(Dirty, rval.Dirty);
+            swap(Wback, rval.Wback);
+            swap(Evicted, rval.Evicted);
+            swap(Var, rval.Var);
+            swap(Uid, rval.Uid);
+            swap(Mtime, rval.Mtime);
             swap(Label, rval.Label);
 
             return *this;
@@ -89,6 +169,13 @@ public:
 
         size_t      Used    = 0;
         size_t      Size    = 0;
+        size_t      Alloc   = 0;    /* allocated bytes, no holes    */
+        size_t      Dirty   = 0;    /* only for extended backends   */
+        size_t      Wback   = 0;
+        size_t      Evicted = 0;    /* recently evicted pages bytes */
+        double      Var     = 0;    /* variance of sampled Used     */
+        uint32_t    Uid     = 0;    /* owner and mtime, for groups  */
+        time_t      Mtime   = 0;
         Ref         Label;
     };
 
@@ -99,117 +186,569 @@ public:
         virtual TEntry pop() noexcept = 0;
     };
 
+    /* Bounded min heap keyed by usage and the push sequence, thus ties
+        are resolved as by ordered multimap: older entries are evicted
+        first and newer popped first. Entries under the minimum of the
+        full heap are rejected without touching the heap at all.    */
+
     class ReTop : public IReduct {
     public:
-        ReTop(size_t limit_) : limit(limit_) { }
+        ReTop(size_t limit_) : limit(limit_)
+        {
+            heap.reserve(std::min(limit, size_t(1) << 16));
+        }
 
     protected:
+        struct TSlot {
+            bool operator <(const TSlot &rval) const noexcept
+            {
+                return Key < rval.Key || (Key == rval.Key && Seq < rval.Seq);
+            }
+
+            TEntry::TKey    Key = 0;
+            size_t          Seq = 0;
+            TEntry          Entry;
+        };
+
+        static bool Above(const TSlot &one, const TSlot &two) noexcept
+        {
+            return two < one;
+        }
+
         void push(TEntry entry) noexcept override
         {
-            heap.emplace(entry.Used, std::move(entry));
+            if (limit == 0) return;
+
+            const TEntry::TKey key = entry.Used;
+
+            if (heap.size() < limit) {
+                entry.Label.keep();
+
+                heap.push_back(TSlot{ key, seq++, std::move(entry) });
+            } else if (key < heap.front().Key) {
+                return;
+            } else {
+                entry.Label.keep();
+
+                std::pop_heap(heap.begin(), heap.end(), Above);
 
-            if (heap.size() > limit) {
-                heap.erase(heap.begin());
+                heap.back() = TSlot{ key, seq++, std::move(entry) };
             }
+
+            std::push_heap(heap.begin(), heap.end(), Above);
         }
 
         TEntry pop() noexcept override
         {
             TEntry   last;
 
+            if (std::exchange(sorted, true) == false)
+                std::sort(heap.begin(), heap.end());
+
             if (heap.size() > 0) {
-                last = std::move(heap.rbegin()->second);
-                heap.erase(std::prev(heap.end()));
+                last = std::move(heap.back().Entry);
+                heap.pop_back();
             }
 
             return last;
         }
 
     private:
-        using THeap = std::multimap<TEntry::TKey, TEntry>;
-
         size_t      limit = 0;
-        THeap        heap;
+        size_t      seq = 0;
+        bool        sorted = false;
+        std::vector<TSlot> heap;
+    };
+
+    /* Sums up entries into groups by the key in the hash table, groups
+        are popped in the order of usage, the key is the group label */
+
+    class ReGroup : public IReduct {
+    public:
+        using TKey = std::function<std::string(const TEntry&)>;
+
+        ReGroup(TKey key_) : key(std::move(key_)) { }
+
+    protected:
+        void push(TEntry entry) noexcept override
+        {
+            std::string name = key(entry);
+
+            auto it = groups.find(name);
+
+            if (it == groups.end()) {
+                auto ref = NUtils::NDir::Ref(NOs::ENode::Dir, 0, name);
+
+                it = groups.emplace(std::move(name), TEntry(0, 0, std::move(ref))).first;
+            }
+
+            it->second.Merge(entry);
+        }
+
+        TEntry pop() noexcept override
+        {
+            if (std::exchange(sorted, true) == false) {
+                for (auto &one : groups) order.push_back(std::move(one.second));
+
+                groups.clear();
+
+                std::sort(order.begin(), order.end(), [](const TEntry &one, const TEntry &two) {
+                    return one.Used < two.Used
+                            || (one.Used == two.Used && one.Label.name > two.Label.name);
+                });
+            }
+
+            TEntry   last;
+
+            if (order.size() > 0) {
+                last = std::move(order.back());
+                order.pop_back();
+            }
+
+            return last;
+        }
+
+    private:
+        TKey        key;
+        bool        sorted = false;
+        std::unordered_map<std::string, TEntry> groups;
+        std::vector<TEntry> order;
     };
 
+    using TSink = std::function<void(const NOutput::TRow&)>;
+
     TTop(const TCfg &cfg_) : cfg(cfg_) { }
 
     void Do(const std::string &root)
     {
         NUtils::NDir::TWalk walk(root);
 
-        Do(root, walk);
+        Do(walk);
     }
 
-    void Do(std::istream &in)
+    void Do(std::istream &in, char delim = '\n')
     {
-        NUtils::NDir::TList list(in);
+        NUtils::NDir::TList list(in, delim);
 
-        Do("", list);
+        Do(list);
+    }
+
+    /* Reduces entries of files known without the walk, as of serve
+        mode. Files under the edge are summed into their directory of
+        the edge depth as by the walk, the rest goes through the same
+        filters and reductors, rows are given to the sink.          */
+
+    void Reduce(std::vector<TEntry> &entries, TSink to)
+    {
+        using namespace NUtils;
+
+        MakeReductor();
+
+        sink = std::move(to);
+
+        std::unordered_map<std::string, TEntry> dirs;
+
+        for (auto &entry : entries) {
+            if (entry.Label.depth <= cfg.edge) {
+                Feed(std::move(entry));
+
+                continue;
+            }
+
+            std::string name = Prefix(entry.Label.path(), cfg.edge);
+
+            auto it = dirs.find(name);
+
+            if (it == dirs.end()) {
+                auto ref = NDir::Ref(NOs::ENode::Dir, cfg.edge, name);
+
+                it = dirs.emplace(std::move(name), TEntry(0, 0, std::move(ref))).first;
+            }
+
+            it->second.Merge(entry);
+        }
+
+        for (auto &dir : dirs) Feed(std::move(dir.second));
+
+        Drain();
+
+        sink = nullptr;
     }
 
 protected:
-    void Do(const std::string &root, NUtils::NDir::IEnum &walk)
+    static constexpr size_t Batch = 16;
+
+    struct TWorker {
+        TWorker(const TCfg &cfg, NProbe::EKind kind, uint64_t seed)
+            : probe(NProbe::Make(kind, cfg.window)), sampler(cfg.sample, seed)
+            , spans(cfg.window)
+        {
+
+        }
+
+        NProbe::TBackend    probe;
+        NProbe::TSampler    sampler;
+        TProbe              spans;  /* exact runs for snapshots     */
+    };
+
+    enum EDup {
+        DUP_NONE    = 0,
+        DUP_OWNER   = 1,    /* first path of a hardlinked inode */
+        DUP_COPY    = 2,    /* inode is already seen, no probe  */
+    };
+
+    struct TJob {
+        TEntry              entry;
+        NOs::TFile          file;
+        std::string         error;
+        std::vector<NUtils::TSpan> runs;
+        NOs::TLoc           loc;
+        size_t              bytes   = 0;
+        double              chance  = 1;    /* of the file in sample */
+        EDup                dup     = DUP_NONE;
+        uint32_t            link    = 0;
+        bool                opened  = false;
+        std::atomic<bool>   done{ false };
+    };
+
+    struct TCharge {
+        size_t      Used    = 0;
+        size_t      Dirty   = 0;
+        size_t      Wback   = 0;
+        size_t      Evicted = 0;
+        double      Var     = 0;
+    };
+
+    void Do(NUtils::NDir::IEnum &walk)
     {
         using namespace NUtils;
 
         MakeReductor();
 
-        TProbe probe;
-        TEntry top(0, 0, NDir::Ref(NOs::ENode::Dir, 0, ":summary"));
-        TEntry aggr;
+        top = TEntry(0, 0, NDir::Ref(NOs::ENode::Dir, 0, ":summary"));
 
-        while (walk) {
-            auto ref = walk.next();
+        if (!cfg.snapshot.empty())
+            writer.reset(new NSnap::TWriter(cfg.snapshot));
 
-            if (aggr && !aggr.Label.IsAbove(ref))
-                Feed(std::move(aggr));
+        /* Files are probed out of order on the pool, but results are
+            retired strictly in the walk order through the ring, thus
+            aggregation and reduction are the same as for serial run */
 
-            if (ref.type == NOs::ENode::Dir) {
-                if (ref.depth == cfg.edge) {
-                    assert(!aggr);
+        const size_t window = cfg.threads > 0 ? cfg.threads * 64 : 1;
 
-                    aggr = TEntry(0, 0, std::move(ref));
-                }
+        std::vector<TJob>   ring(window);
+        std::vector<TWorker> workers;
+        std::random_device seed;
 
-            } else if (ref.type == NOs::ENode::File) {
-                NOs::TFile file;
+        for (size_t z = 0; z < std::max(cfg.threads, 1u); z++)
+            workers.emplace_back(cfg, cfg.backend, seed());
 
-                const auto path = NDir::TPath(root).add(ref);
+        picker = NProbe::TPicker(cfg.files, seed());
 
-                try {
-                    file = NOs::TFile(path);
-                } catch (TError &error) {
-                    std::cerr << "cannot open file " << ref.name << std::endl;
+        extended = cfg.extend && workers[0].probe->Extended();
 
-                    continue;
-                }
+        if (cfg.extend && !extended)
+            std::cerr << "extended counters need cachestat() backend" << std::endl;
 
-                if (file.Size() > 0) {
-                    auto map = file.MMap();
+        output.reset(new NOutput::TFormat(cfg.format, cfg.sampled(), extended));
 
-                    TEntry entry(((NOs::TMemRg)map).paged(), 0, std::move(ref));
+        std::unique_ptr<TPool> pool;
 
-                    probe(map, [&](NUtils::TSpan &span) { entry.Used += span.bytes;});
+        if (cfg.threads > 0) pool.reset(new TPool(cfg.threads));
 
-                    top += entry;
+        /* Opened files are handed to the pool by batches, the batch is
+            pushed when it is full or before waiting for the ring head */
 
-                    if (aggr) {
-                        aggr += entry;
-                    } else {
-                        Feed(std::move(entry));
-                    }
+        std::vector<TJob*> batch;
+
+        auto flush = [&]() {
+            if (batch.empty()) return;
+
+            pool->Push([&, jobs = std::move(batch)](size_t worker) {
+                for (auto *at : jobs) Probe(*at, workers[worker]);
+
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+
+                    for (auto *at : jobs) at->done = true;
                 }
 
-            } else if (ref.type == NOs::ENode::Access) {
-                std::cerr << "cannot deep to " << ref.name << std::endl;
+                ready.notify_one();
+            });
+
+            batch.clear();
+        };
+
+        size_t head = 0, tail = 0;
+
+        while (walk) {
+            if (tail - head == window) {
+                flush();
+
+                Retire(Wait(ring[head++ % window]));
+            }
+
+            TJob &job = ring[tail++ % window];
+
+            job.entry = TEntry(0, 0, walk.next());
+            job.done = false;
+
+            /* names are viewed in the walker until the next entry, the
+                serial run retires each file before, so copies only jobs
+                which are left in the ring for the pool              */
+
+            if (pool) job.entry.Label.keep();
+
+            if (job.entry.Label.type != NOs::ENode::File) {
+                job.done = true;
+            } else if (!Open(job, walk)) {
+                job.done = true;
+            } else {
+                if (!pool) {
+                    Probe(job, workers[0]);
+
+                    job.done = true;
+                } else {
+                    batch.push_back(&job);
+
+                    if (batch.size() >= Batch) flush();
+                }
             }
+
+            while (head < tail && ring[head % window].done)
+                Retire(ring[head++ % window]);
         }
 
+        if (pool) flush();
+
+        while (head < tail) Retire(Wait(ring[head++ % window]));
+
+        if (aggr) Feed(std::move(aggr));
+
+        if (writer) writer->Close();
+
         if (cfg.summary)
             Print(top);
 
         Drain();
+
+        output->Flush();
+    }
+
+    /* Files are opened by the walker relative to the descriptor of
+        its current directory, the rest of work is done by workers.
+        Hardlinks are resolved here too, in the walk order, thus the
+        first path of an inode is always the same as for serial run.
+        With sampling of files they are stated first and only taken
+        ones are opened, the rest adds only its size to the sums.   */
+
+    bool Open(TJob &job, NUtils::NDir::IEnum &walk)
+    {
+        job.error.clear();
+        job.dup = DUP_NONE;
+        job.chance = 1;
+
+        if (picker) {
+            const NOs::TStat info = walk.stat(job.entry.Label);
+
+            if (info.Type != NOs::ENode::File) {
+                job.opened = false;
+
+                return false;
+            }
+
+            Account(job, info);
+
+            if (job.dup == DUP_COPY) return false;
+
+            job.chance = picker.Chance(job.bytes);
+
+            if (!picker(job.chance)) return false;
+        }
+
+        try {
+            job.file = walk.open(job.entry.Label);
+        } catch (TError &error) {
+            job.opened = false;
+
+            return false;
+        }
+
+        if (!picker) {
+            Account(job, NOs::TStat(job.file));
+
+            if (job.dup == DUP_COPY) job.file.Close();
+        }
+
+        return job.dup != DUP_COPY;
+    }
+
+    void Account(TJob &job, const NOs::TStat &info)
+    {
+        job.opened = true;
+        job.loc = info.Loc;
+        job.bytes = info.Bytes;
+        job.entry.Size = NUtils::TGran(getpagesize(), { 0, job.bytes }).paged();
+        job.entry.Alloc = std::min<size_t>(job.entry.Size, info.Alloc);
+        job.entry.Uid = info.Uid;
+        job.entry.Mtime = info.Mtime;
+
+        if (cfg.links != TCfg::LINKS_ALL && info.Links > 1 && job.bytes > 0) {
+            auto put = NUtils::TLinks::PUT_FULL;
+
+            try {
+                put = links.Put(info.Loc, job.link);
+            } catch (std::bad_alloc &error) {
+                /* the set is intact, inodes are not tracked further */
+            }
+
+            if (put == NUtils::TLinks::PUT_NEW) {
+                job.dup = DUP_OWNER;
+            } else if (put == NUtils::TLinks::PUT_SEEN) {
+                job.dup = DUP_COPY;
+            } else if (std::exchange(overflow, true) == false) {
+                std::cerr << "too many hardlinked inodes to track" << std::endl;
+            }
+        }
+
+    }
+
+    void Probe(TJob &job, TWorker &worker) noexcept
+    {
+        NOs::TFile file(std::move(job.file));
+
+        try {
+            if (const size_t bytes = job.bytes) {
+                const NUtils::TGran all(getpagesize(), NUtils::TSpan(0, bytes));
+
+                TEntry &entry = job.entry;
+
+                entry.Size      = all.paged();
+
+                if (writer) {
+                    job.runs.clear();
+
+                    worker.spans(file, all, [&](NUtils::TSpan &span) {
+                        job.runs.push_back(span);
+
+                        entry.Used += span.bytes;
+                    });
+
+                    return;
+                }
+
+                NProbe::TEstimate est;
+
+                if (worker.sampler && !worker.sampler.Covers(all)) {
+                    est = worker.sampler(*worker.probe, file, all);
+                } else {
+                    const auto usage = worker.probe->Count(file, all);
+
+                    est.Used        = usage.Cached * all.gran();
+                    entry.Dirty     = usage.Dirty * all.gran() / job.chance + 0.5;
+                    entry.Wback     = usage.Writeback * all.gran() / job.chance + 0.5;
+                    entry.Evicted   = usage.Recent * all.gran() / job.chance + 0.5;
+                }
+
+                est = NProbe::TPicker::Weigh(est, job.chance);
+
+                entry.Used  = size_t(est.Used + 0.5);
+                entry.Var   = est.Var;
+            }
+        } catch (TError &error) {
+            job.error = error.what();
+        }
+    }
+
+    TJob& Wait(TJob &job)
+    {
+        std::unique_lock<std::mutex> guard(lock);
+
+        ready.wait(guard, [&]() { return job.done.load(); });
+
+        return job;
+    }
+
+    void Retire(TJob &job)
+    {
+        auto &ref = job.entry.Label;
+
+        if (aggr && !aggr.Label.IsAbove(ref))
+            Feed(std::move(aggr));
+
+        if (ref.type == NOs::ENode::Dir) {
+            if (ref.depth == cfg.edge) {
+                assert(!aggr);
+
+                aggr = TEntry(0, 0, std::move(ref.keep()));
+            }
+
+        } else if (ref.type == NOs::ENode::File) {
+            if (!job.opened) {
+                std::cerr << "cannot open file " << ref.path() << std::endl;
+            } else if (!job.error.empty()) {
+                std::cerr << job.error << " for " << ref.path() << std::endl;
+            } else if (job.dup == DUP_COPY) {
+                Charge(job);
+            } else if (job.entry.Size > 0) {
+                if (job.dup == DUP_OWNER) Keep(job);
+
+                if (writer)
+                    writer->Add(ref.path(), job.bytes, job.loc, job.runs);
+
+                top += job.entry;
+
+                if (aggr) {
+                    aggr += job.entry;
+                } else {
+                    Feed(std::move(job.entry));
+                }
+            }
+
+        } else if (ref.type == NOs::ENode::Access) {
+            std::cerr << "cannot deep to " << ref.path() << std::endl;
+        }
+    }
+
+    /* Only inodes with any usage are kept, others are charged zero */
+
+    void Keep(const TJob &job)
+    {
+        const TEntry &entry = job.entry;
+
+        if (cfg.links == TCfg::LINKS_EVERY && (entry.Used || entry.Dirty
+                    || entry.Wback || entry.Evicted || entry.Var > 0)) {
+            charges.Put(job.link, TCharge{
+                entry.Used, entry.Dirty, entry.Wback, entry.Evicted, entry.Var
+            });
+        }
+    }
+
+    /* Another path of already probed inode, it goes to aggregation
+        and output for the every path mode, but never to summary   */
+
+    void Charge(TJob &job)
+    {
+        if (cfg.links == TCfg::LINKS_EVERY) {
+            static const TCharge none;
+
+            const auto *found = charges.Find(job.link);
+            const TCharge &was = found ? *found : none;
+
+            TEntry &entry = job.entry;
+
+            entry.Used      = was.Used;
+            entry.Dirty     = was.Dirty;
+            entry.Wback     = was.Wback;
+            entry.Evicted   = was.Evicted;
+            entry.Var       = was.Var;
+
+            if (aggr) {
+                aggr += entry;
+            } else {
+                Feed(std::move(entry));
+            }
+        }
     }
 
     void MakeReductor()
@@ -218,15 +757,80 @@ protected:
 
         if (cfg.reduct == TCfg::REDUCT_TOP) {
             reduct = TRePtr(new ReTop(cfg.limit));
+        } else if (cfg.reduct == TCfg::REDUCT_EXT) {
+            reduct = TRePtr(new ReGroup(&Ext));
+        } else if (cfg.reduct == TCfg::REDUCT_PREFIX) {
+            reduct = TRePtr(new ReGroup([this](const TEntry &entry) {
+                return Prefix(entry.Label.path(), cfg.prefix);
+            }));
+        } else if (cfg.reduct == TCfg::REDUCT_UID) {
+            reduct = TRePtr(new ReGroup([](const TEntry &entry) {
+                return "uid " + std::to_string(entry.Uid);
+            }));
+        } else if (cfg.reduct == TCfg::REDUCT_AGE) {
+            reduct = TRePtr(new ReGroup([now = time(nullptr)](const TEntry &entry) {
+                return Age(now - entry.Mtime);
+            }));
         }
+
+        grouped = cfg.reduct >= TCfg::REDUCT_EXT;
+    }
+
+    static std::string Ext(const TEntry &entry)
+    {
+        const std::string_view name = entry.Label.name;
+
+        const size_t slash = name.rfind('/');
+        const size_t base = slash == name.npos ? 0 : slash + 1;
+        const size_t dot = name.rfind('.');
+
+        if (dot == name.npos || dot <= base) return "*";
+
+        return "*" + std::string(name.substr(dot));
     }
 
+    /* Directory part of the path limited by depth components */
+
+    static std::string Prefix(const std::string &path, unsigned depth)
+    {
+        size_t cut = path.size() > 0 && path[0] == '/' ? 1 : 0, end = cut;
+
+        for (unsigned n = 0; n < depth; n++) {
+            const size_t next = path.find('/', cut);
+
+            if (next == std::string::npos) break;
+
+            end = next, cut = next + 1;
+        }
+
+        return end == 0 ? "." : path.substr(0, end);
+    }
+
+    static std::string Age(time_t age)
+    {
+        static const std::pair<time_t, const char*> buckets[] = {
+            { 3600, "age < 1h" },
+            { 86400, "age < 1d" },
+            { 7 * 86400, "age < 7d" },
+            { 30 * 86400, "age < 30d" },
+            { 365 * 86400, "age < 1y" },
+        };
+
+        for (auto &bucket : buckets) {
+            if (age < bucket.first) return bucket.second;
+        }
+
+        return "age >= 1y";
+    }
+
+    /* Groups take all files, the filters are applied to groups */
+
     void Feed(TEntry entry)
     {
-        if (entry.Used == 0 && !cfg.zeroes) {
-            /* ignore unsued entries        */
-        } else if (entry.raito() < cfg.raito) {
-            /* ignore entries under edge    */
+        if (grouped) {
+            reduct->push(std::move(entry));
+        } else if (Skip(entry)) {
+            /* ignore unused or under edge  */
         } else if (reduct) {
             reduct->push(std::move(entry));
         } else {
@@ -234,27 +838,70 @@ protected:
         }
     }
 
+    bool Skip(const TEntry &entry) const noexcept
+    {
+        if (entry.Used == 0 && !cfg.zeroes) {
+            return true;    /* ignore unsued entries        */
+        } else if (entry.raito() < cfg.raito) {
+            return true;    /* ignore entries under edge    */
+        }
+
+        return false;
+    }
+
     void Drain()
     {
         if (auto was = std::exchange(reduct, { }))
-            while (auto last = was->pop()) Print(last);
+            while (auto last = was->pop()) {
+                if (!grouped || !Skip(last)) Print(last);
+            }
     }
 
     void Print(const TEntry &entry)
     {
-        std::cout
-            << std::setw(5) << NHumans::Value(entry.Used)
-            << " of "
-            << std::setw(5) << NHumans::Value(entry.Size)
-            << " "
-            << std::setw(2) << entry.Label.depth
-            << " "
-            << entry.Label.name
-            << std::endl;
+        NOutput::TRow row;
+
+        row.Used    = entry.Used;
+        row.Size    = entry.Size;
+        row.Alloc   = entry.Alloc;
+        row.Dirty   = entry.Dirty;
+        row.Wback   = entry.Wback;
+        row.Evicted = entry.Evicted;
+        row.Depth   = entry.Label.depth;
+
+        if (cfg.sampled()) {
+            const NProbe::TEstimate est{ double(entry.Used), entry.Var };
+
+            row.Margin = est.Margin();
+        }
+
+        entry.Label.path(path);
+
+        row.Path = path;
+
+        if (sink) {
+            sink(row);
+        } else {
+            (*output)(row);
+        }
     }
 
     using TRePtr = std::unique_ptr<IReduct>;
 
     const TCfg  &cfg;
     TRePtr      reduct;
+    bool        extended = false;
+    bool        overflow = false;
+    bool        grouped = false;
+    std::string path;   /* reused buffer for printed paths  */
+    std::unique_ptr<NOutput::TFormat> output;
+    TSink       sink;   /* rows of Reduce() instead of output */
+    TEntry      top;
+    TEntry      aggr;
+    std::mutex  lock;
+    std::condition_variable ready;
+    NUtils::TLinks          links{ cfg.inodes };
+    std::unique_ptr<NSnap::TWriter> writer;
+    NUtils::TLinkValues<TCharge> charges;
+    NProbe::TPicker         picker{ 0, 0 };
 };
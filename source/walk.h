@@ -2,27 +2,125 @@
 
 #pragma once
 
+#include <fcntl.h>
 #include <dirent.h>
+#include <unistd.h>
 #include <sys/types.h>
+#include <sys/syscall.h>
 
 #include <sstream>
 #include <utility>
+#include <memory>
+#include <vector>
+#include <string_view>
 #include <list>
+#include <cstring>
+#include <iostream>
+#include <unordered_set>
+#include "error.h"
+#include "file.h"
 #include "span.h"
 
 namespace NUtils::NDir {
 
+    /* Chain of parent directories, it is shared by all refs of a
+        directory and allows to build full path only when needed   */
+
+    struct TNode {
+        using TRef = std::shared_ptr<const TNode>;
+
+        TRef            up;
+        std::string     name;
+    };
+
+    /* The name is either owned by the ref or is a view to buffers of
+        the walker, the view is valid only until the next call of its
+        next(). Refs which are kept longer have to take a copy by keep() */
+
     struct Ref {
         Ref() = default;
 
-        Ref(Ref &&ref) : type(ref.type), depth(ref.depth) {
-            name = std::move(ref.name);
+        Ref(Ref &&ref) noexcept {
+            *this = std::move(ref);
         }
 
-        Ref(NOs::ENode type_, unsigned depth_, std::string name_)
-            : type(type_), depth(depth_), name(name_)
+        Ref& operator =(Ref &&ref) noexcept
+        {
+            type = ref.type, depth = ref.depth;
+
+            if (ref.owned()) {
+                own = std::move(ref.own), name = own;
+            } else {
+                name = ref.name;
+            }
+
+            ref.name = { };
+
+            up = std::move(ref.up);
+
+            return *this;
+        }
+
+        Ref(NOs::ENode type_, unsigned depth_, std::string name_,
+                TNode::TRef up_ = { })
+            : type(type_), depth(depth_), up(std::move(up_))
+            , own(std::move(name_))
         {
             assert(type != NOs::ENode::None);
+
+            name = own;
+        }
+
+        static Ref View(NOs::ENode type, unsigned depth, std::string_view name,
+                TNode::TRef up)
+        {
+            Ref ref(type, depth, { }, std::move(up));
+
+            ref.name = name;
+
+            return ref;
+        }
+
+        /* Copies the viewed name, thus the ref outlives the walker */
+
+        Ref& keep()
+        {
+            if (!owned()) own.assign(name), name = own;
+
+            return *this;
+        }
+
+        bool owned() const noexcept {
+            return name.data() == own.data();
+        }
+
+        /* Path relative to the walk root, name for flat refs */
+
+        std::string path() const
+        {
+            std::string path;
+
+            return this->path(path), path;
+        }
+
+        /* Fills the given string reusing its storage */
+
+        void path(std::string &path) const
+        {
+            size_t bytes = name.size();
+
+            for (auto *it = up.get(); it; it = it->up.get())
+                bytes += it->name.size() + 1;
+
+            path.assign(bytes, '/');
+
+            path.replace(bytes -= name.size(), name.size(), name);
+
+            for (auto *it = up.get(); it; it = it->up.get()) {
+                bytes -= it->name.size() + 1;
+
+                path.replace(bytes, it->name.size(), it->name);
+            }
         }
 
         explicit operator bool() const noexcept {
@@ -35,14 +133,18 @@ namespace NUtils::NDir {
 
         NOs::ENode      type = NOs::None;
         unsigned        depth = 0;
-        std::string     name;
+        std::string_view name;
+        TNode::TRef     up;
+
+    private:
+        std::string     own;
     };
 
-    void swap(Ref &left, Ref &right)
+    void swap(Ref &left, Ref &right) noexcept
     {
-        std::swap(left.type, right.type);
-        std::swap(left.depth, right.depth);
-        std::swap(left.name, right.name);
+        Ref was(std::move(left));
+
+        left = std::move(right), right = std::move(was);
     }
 
     class TPath {
@@ -54,10 +156,10 @@ namespace NUtils::NDir {
         }
 
         TPath& add(const Ref &ref) {
-            return add(ref.name);
+            return add(ref.path());
         }
 
-        TPath& add(const std::string &name)
+        TPath& add(std::string_view name)
         {
             if (level++ > 0)
                 path.append(1, '/');
@@ -80,6 +182,57 @@ namespace NUtils::NDir {
         virtual ~IEnum() noexcept { }
         virtual explicit operator bool() const noexcept = 0;
         virtual Ref next() = 0;
+
+        /* Opens file of the ref just returned by next() */
+        virtual NOs::TFile open(const Ref &ref) {
+            return NOs::TFile(ref.path());
+        }
+
+        /* Stats file of the ref just returned, without opening it */
+        virtual NOs::TStat stat(const Ref &ref) {
+            return NOs::TStat(ref.path());
+        }
+    };
+
+    /* Entry of a directory, the name is a view to the buffer of
+        iterator, it is valid only until the next call of next() */
+
+    struct TDent {
+        explicit operator bool() const noexcept {
+            return type != NOs::ENode::None;
+        }
+
+        NOs::ENode          type = NOs::ENode::None;
+        std::string_view    name;
+    };
+
+    /* Reusable buffers for reading directories, it is owned by a
+        walker and shared with iterators of all the stack levels */
+
+    class TArena {
+    public:
+        using TBuf = std::unique_ptr<char[]>;
+
+        static constexpr size_t Bytes = 256 * 1024;
+
+        TBuf take()
+        {
+            if (free.empty()) return TBuf(new char[Bytes]);
+
+            TBuf buf = std::move(free.back());
+
+            free.pop_back();
+
+            return buf;
+        }
+
+        void give(TBuf buf)
+        {
+            if (buf) free.push_back(std::move(buf));
+        }
+
+    private:
+        std::vector<TBuf> free;
     };
 
     class TIter {
@@ -87,14 +240,18 @@ namespace NUtils::NDir {
         TIter() = default;
         TIter(const TIter&) = delete;
 
-        TIter(TIter &&iter) {
-            std::swap(stream, iter.stream);
+        TIter(TIter &&iter) noexcept {
+            *this = std::move(iter);
         }
 
-        TIter(const std::string &path)
+        TIter(int at, const std::string &path, TArena &arena_) : arena(&arena_)
         {
-            if (!(stream = opendir(path.c_str())))
+            const int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+
+            if ((fd = ::openat(at, path.c_str(), flags)) < 0)
                 throw TError("Cannot open directory");
+
+            buf = arena->take();
         }
 
         ~TIter() {
@@ -102,18 +259,42 @@ namespace NUtils::NDir {
         }
 
         explicit operator bool() const noexcept {
-            return stream != nullptr;
+            return fd > -1;
         }
 
-        void operator =(TIter &&iter) noexcept {
-            std::swap(stream, iter.stream);
+        int dir() const noexcept { return fd; }
+
+        TIter& operator =(TIter &&iter) noexcept
+        {
+            std::swap(fd, iter.fd);
+            std::swap(pos, iter.pos);
+            std::swap(got, iter.got);
+            std::swap(failed, iter.failed);
+            std::swap(buf, iter.buf);
+            std::swap(arena, iter.arena);
+
+            return *this;
         }
 
-        Ref next()
+        /* Error of reading the directory gives the Access entry and ends
+            the listing, thus it is not truncated silently          */
+
+        TDent next()
         {
             while (*this) {
-                if (struct dirent *entry = readdir(stream)) {
-                    auto name = std::string(entry->d_name);
+                if (pos >= got && !fill()) {
+                    const bool broken = failed;
+
+                    close();
+
+                    if (broken) return { NOs::ENode::Access, { } };
+
+                } else {
+                    auto *entry = reinterpret_cast<struct dirent64*>(&buf[pos]);
+
+                    pos += entry->d_reclen;
+
+                    const std::string_view name(entry->d_name);
 
                     if (name == ".." || name == ".")
                         continue;
@@ -127,46 +308,71 @@ namespace NUtils::NDir {
                     } else if (entry->d_type == DT_LNK) {
                         type = NOs::ENode::Link;
                     } else if (entry->d_type == DT_UNKNOWN) {
-
+                        type = Resolve(entry->d_name);
                     }
 
-                    return { type, 0, std::move(name) };
-
-                } else
-                    close();
+                    return { type, name };
+                }
             }
 
             return { };
         }
 
     protected:
+        bool fill() noexcept
+        {
+            const long rv = ::syscall(SYS_getdents64, fd, buf.get(), TArena::Bytes);
+
+            pos = 0, got = rv > 0 ? size_t(rv) : 0, failed = rv < 0;
+
+            return got > 0;
+        }
+
+        /* Some filesystems don't fill d_type, it is taken by stat */
+
+        NOs::ENode Resolve(const char *name) const noexcept
+        {
+            const auto type = NOs::TStat(fd, name).Type;
+
+            if (type == NOs::ENode::None || type == NOs::ENode::Access)
+                return NOs::ENode::Other;
+
+            return type;
+        }
+
         void close() noexcept
         {
-            if (auto *was = std::exchange(stream, nullptr)) {
-                closedir(was);
-            }
+            if (fd > -1) ::close(std::exchange(fd, -1));
+
+            if (arena) arena->give(std::move(buf));
         }
 
-        DIR *stream = nullptr;
+        int             fd      = -1;
+        size_t          pos     = 0;
+        size_t          got     = 0;
+        bool            failed  = false;    /* getdents64() error */
+        TArena::TBuf    buf;
+        TArena          *arena  = nullptr;
     };
 
     class TLevel {
     public:
-        TLevel(const std::string &name_) : name(name_) { }
-
-        void open(const std::string &path)
-        {
-            iter = TIter(path);
-        }
+        TLevel(TNode::TRef node_, TIter &&iter_)
+            : node(std::move(node_)), iter(std::move(iter_)) { }
 
-        std::string name;
+        TNode::TRef node;
         TIter       iter;
     };
 
+    /* Walks the tree relative to descriptors of directories, names
+        are kept only for levels, paths are built by refs on demand.
+        Names of files are views to the getdents64() buffer, they are
+        zero terminated there and are passed to openat() as is.    */
+
     class TWalk : public IEnum {
     public:
         TWalk(const std::string &path) {
-            deep(path);
+            stack.emplace_back(nullptr, TIter(AT_FDCWD, path, arena));
         }
 
         explicit operator bool() const noexcept override {
@@ -178,85 +384,102 @@ namespace NUtils::NDir {
             while (!stack.empty()) {
                 TLevel &level = stack.back();
 
-                Ref label = level.iter.next();
+                TDent label = level.iter.next();
                 unsigned depth = stack.size();
 
                 if (!label) {
                     stack.pop_back();
+                } else if (label.type == NOs::ENode::Access) {
+                    /* listing is broken, the directory is reported */
+
+                    const TNode::TRef node = level.node;
+
+                    stack.pop_back();
+
+                    if (!node) return { NOs::ENode::Access, depth - 1, "." };
+
+                    return { NOs::ENode::Access, depth - 1, node->name, node->up };
+
                 } else if (label.type == NOs::ENode::Dir) {
+                    auto node = std::make_shared<const TNode>(
+                                    TNode{ level.node, std::string(label.name) });
+
                     try {
-                        deep(label.name);
+                        TIter iter(level.iter.dir(), node->name, arena);
 
-                        return { NOs::ENode::Dir, depth, trace(false) };
+                        stack.emplace_back(node, std::move(iter));
+
+                        /* the name is viewed in the node of the level */
+
+                        return Ref::View(NOs::ENode::Dir, depth, node->name, level.node);
 
                     } catch (TError &error) {
-                        return { NOs::ENode::Access, depth, trace(false) };
+                        return { NOs::ENode::Access, depth, node->name, level.node };
                     }
 
                 } else {
-                    auto path = trace(false).add(label);
-
-                    return { label.type, depth, path };
+                    return Ref::View(label.type, depth, label.name, level.node);
                 }
             }
 
             return { };
         }
 
-    protected:
-        void deep(const std::string &name)
+        NOs::TFile open(const Ref &ref) override
         {
-            stack.emplace_back(name);
-            stack.back().open(trace(true));
+            assert(!stack.empty() && ref.up == stack.back().node);
+
+            return NOs::TFile(stack.back().iter.dir(), ref.name.data());
         }
 
-        TPath trace(bool full) const noexcept
+        NOs::TStat stat(const Ref &ref) override
         {
-            TPath path;
-
-            if (!stack.empty()) {
-                auto it = std::next(stack.begin(), full ? 0 : 1);
+            assert(!stack.empty() && ref.up == stack.back().node);
 
-                for (; it != stack.end(); it++) path.add(it->name);
-            }
-
-            return path;
+            return NOs::TStat(stack.back().iter.dir(), ref.name.data());
         }
 
     private:
-        std::list<TLevel> stack;
+        TArena              arena;
+        std::list<TLevel>   stack;
     };
 
+    /* List of paths from the stream delimited by new lines or zero
+        bytes, it is read by large blocks. Only components which are
+        not shared with the previous path are checked by lstat(), and
+        directories are cached, so unsorted input doesn't stat them
+        again. Dropped paths are counted and reported at the end.  */
+
     class TList : public IEnum {
     public:
-        TList(std::istream &in_) : in(in_) { }
+        TList(std::istream &in_, char delim_ = '\n')
+            : delim(delim_), in(in_), buf(Block) { }
 
         explicit operator bool() const noexcept override {
-            return in || !refs.empty();
+            return in || pos < len || head < refs.size();
         }
 
         Ref next() override
         {
-            while (*this) {
-                if (refs.empty()) {
-                    std::string line;
+            while (head == refs.size()) {
+                refs.clear(), head = 0;
 
-                    if (std::getline(in, line)) process(line);
-                }
+                const bool got = read(line);
 
-                if (!refs.empty()) {
-                    Ref ref = std::move(refs.front());
+                if (got) process(line);
 
-                    refs.pop_front();
+                if (!in && pos >= len) report();
 
-                    return ref;
-                }
+                if (!got) return { };
             }
 
-            return { };
+            return std::move(refs[head++]);
         }
 
     protected:
+        static constexpr size_t Block = 1 << 20;
+        static constexpr size_t Cache = 1 << 16;
+
         class Slice : public NUtils::TSpan {
         public:
             using NUtils::TSpan::TSpan;
@@ -266,23 +489,80 @@ namespace NUtils::NDir {
             }
         };
 
+        bool read(std::string &path)
+        {
+            while (true) {
+                const char *at = buf.data() + pos, *end = buf.data() + len;
+
+                if (auto *hit = static_cast<const char*>(memchr(at, delim, end - at))) {
+                    path.assign(at, hit);
+                    pos = hit - buf.data() + 1;
+
+                    return true;
+                } else if (!in) {
+                    path.assign(at, end);
+                    pos = len;
+
+                    return at < end;
+                }
+
+                memmove(buf.data(), at, end - at);
+
+                len = end - at, pos = 0;
+
+                if (len == buf.size()) buf.resize(buf.size() * 2);
+
+                in.read(buf.data() + len, buf.size() - len);
+
+                len += in.gcount();
+            }
+        }
+
+        void report()
+        {
+            if (std::exchange(reported, true)) return;
+
+            if (skipped + under + missing + dups > 0) {
+                std::cerr
+                    << "list of " << paths << " paths, "
+                    << skipped << " skipped, "
+                    << under << " under files, "
+                    << missing << " missing, "
+                    << dups << " duplicates" << std::endl;
+            }
+        }
+
         void examine(size_t depth) noexcept
         {
-            NOs::TStat info(stack);
+            NOs::ENode type = NOs::ENode::Dir;
+
+            if (dirs.find(stack) == dirs.end()) {
+                type = NOs::TStat(stack).Type;
+
+                if (type == NOs::ENode::Dir) {
+                    if (dirs.size() >= Cache) dirs.clear();
+
+                    dirs.insert(stack);
+                }
+            }
 
-            if (info.Type != NOs::ENode::Dir) {
+            if (type != NOs::ENode::Dir) {
                 edge = depth;
             }
 
-            if (info.Type != NOs::ENode::None) {
-                refs.emplace_back(info.Type, depth, std::string(stack));
+            if (type != NOs::ENode::None) {
+                refs.emplace_back(type, depth, std::string(stack));
+            } else {
+                missing++;
             }
         }
 
         void process(const std::string &path) noexcept
         {
+            paths++;
+
             if (!check(path)) {
-                /* TODO: collect stats  */
+                skipped++;  /* empty or relative mixed with absolute */
             } else {
                 Slice on, to;
 
@@ -290,11 +570,27 @@ namespace NUtils::NDir {
                     on = forward(stack, on.after());
                     to = forward(path, to.after());
 
-                    if (!same(on, to, path)) {
+                    if (!on && !to) {
+                        dups++;
+
+                        return;
+
+                    } else if (depth > edge) {
+                        under++;    /* the prefix is not a directory */
+
+                        return;
+
+                    } else if (!same(on, to, path)) {
                         edge = -1;
 
                         stack.resize((size_t)on - (on ? 1 : 0));
 
+                        if (!to) {
+                            dups++; /* directory above the last path */
+
+                            return;
+                        }
+
                         for (; to; depth++) {
                             extend(path, to);
                             examine(depth);
@@ -302,11 +598,6 @@ namespace NUtils::NDir {
                             to = forward(path, to.after());
                         }
 
-                        return;
-
-                    } else if (depth > edge) {
-                        /* TODO: collect stats */
-
                         return;
                     }
                 }
@@ -359,9 +650,39 @@ namespace NUtils::NDir {
 
         bool            first       = true;
         bool            relative    = false;
+        bool            reported    = false;
+        char            delim       = '\n';
         size_t          edge        = -1;
+        size_t          pos         = 0;
+        size_t          len         = 0;
+        size_t          head        = 0;
+        size_t          paths       = 0;
+        size_t          skipped     = 0;
+        size_t          under       = 0;
+        size_t          missing     = 0;
+        size_t          dups        = 0;
         std::istream    &in;
+        std::vector<char> buf;
+        std::string     line;
         std::string     stack;
-        std::list<Ref>  refs;
+        std::vector<Ref> refs;
+        std::unordered_set<std::string> dirs;
+    };
+
+    /* Enumerator of a single file given by path */
+
+    class TOne : public IEnum {
+    public:
+        TOne(const std::string &path_) : path(path_) { }
+
+        explicit operator bool() const noexcept override { return !path.empty(); }
+
+        Ref next() override
+        {
+            return { NOs::ENode::File, 0, std::exchange(path, { }) };
+        }
+
+    protected:
+        std::string path;
     };
 }
@@ -0,0 +1,377 @@
+#pragma once /*__ GPL 3.0, 2020 Alexander Soloviev (no.friday@yandex.ru) */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <condition_variable>
+
+#include "file.h"
+#include "tiny.h"
+#include "snap.h"
+#include "pool.h"
+#include "probe.h"
+#include "humans.h"
+
+class TMod_Warmup {
+
+    struct TCfg {
+        std::string Base;       /* Prefix for relative paths        */
+        unsigned Threads = 4;
+        uint64_t Gap = 1 << 20; /* Coalesce runs closer than, bytes */
+        uint64_t Piece = 4 << 20; /* Bytes per single IO request   */
+        uint64_t Rate = 0;      /* Bandwidth cap, bytes/s, 0 is off */
+        uint64_t Period = 5;    /* Progress report period, secs     */
+        bool Fadvise = false;   /* POSIX_FADV_WILLNEED over readahead */
+    };
+
+    using TRun = NSnap::TRun;
+
+    /* Shared token bucket, each taker reserves its bytes slot in the
+        future timeline and sleeps until the slot is reached         */
+
+    class TThrottle {
+        using TClock = std::chrono::steady_clock;
+
+    public:
+        TThrottle(uint64_t rate_) : rate(rate_) { }
+
+        void Take(uint64_t bytes)
+        {
+            if (rate == 0) return;
+
+            TClock::time_point when;
+
+            {
+                std::lock_guard<std::mutex> guard(lock);
+
+                const auto now = TClock::now();
+
+                if (next < now) next = now;
+
+                when = next;
+
+                next += std::chrono::duration_cast<TClock::duration>(
+                            std::chrono::duration<double>(double(bytes) / rate));
+            }
+
+            std::this_thread::sleep_until(when);
+        }
+
+    protected:
+        uint64_t            rate = 0;
+        std::mutex          lock;
+        TClock::time_point  next;
+    };
+
+public:
+    int Handle(int argc, char *argv[])
+    {
+        extern char *optarg;
+
+        std::string path;
+        TCfg cfg{ };
+
+        while (true) {
+            static const char opts[] = "i:f:j:g:b:r:p:a";
+
+            const int opt = getopt(argc, argv, opts);
+
+            if (opt < 0) break;
+
+            if (opt == 'i') {
+                path = optarg;
+            } else if (opt == 'f') {
+                cfg.Base = optarg;
+            } else if (opt == 'j') {
+                cfg.Threads = std::max(1ul, std::stoul(optarg));
+            } else if (opt == 'g') {
+                cfg.Gap = std::stoull(optarg);
+            } else if (opt == 'b') {
+                cfg.Piece = std::max(4096ull, std::stoull(optarg));
+            } else if (opt == 'r') {
+                cfg.Rate = std::stoull(optarg) * 1024 * 1024;
+            } else if (opt == 'p') {
+                cfg.Period = std::max(1ull, std::stoull(optarg));
+            } else if (opt == 'a') {
+                cfg.Fadvise = true;
+            }
+        }
+
+        if (path.empty()) {
+            std::cerr << "residency snapshot -i is not given\n";
+
+            return 1;
+        }
+
+        return Run(path, cfg);
+    }
+
+    int Run(const std::string &path, const TCfg &cfg)
+    {
+        const NSnap::TReader snap(path);
+
+        page = snap.Head().Page;
+
+        if (page != size_t(getpagesize())) {
+            std::cerr << "snapshot is taken with different page size\n";
+
+            return 2;
+        }
+
+        std::vector<NSnap::TItem> items;
+
+        snap.Each([&](const NSnap::TItem &item) {
+            if (item.Rec->Runs > 0) items.push_back(item);
+        });
+
+        for (auto &item : items) {
+            target += Pages(item, NMisc::DivUp(item.Rec->Size, page)) * page;
+        }
+
+        TThrottle throttle(cfg.Rate);
+
+        std::vector<char> warmed(items.size(), false);   /* not skipped */
+
+        {
+            std::vector<TProbe> probes(cfg.Threads);
+
+            NUtils::TPool pool(cfg.Threads);
+
+            for (size_t z = 0; z < items.size(); z++) {
+                pool.Push([&, z](size_t worker) {
+                    warmed[z] = Warm(items[z], cfg, throttle, probes[worker]);
+
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+
+                        done++;
+                    }
+
+                    wake.notify_one();
+                });
+            }
+
+            std::unique_lock<std::mutex> guard(lock);
+
+            while (done < items.size()) {
+                const auto period = std::chrono::seconds(cfg.Period);
+
+                if (!wake.wait_for(guard, period, [&]() { return done == items.size(); }))
+                    Report(items.size(), "progress");
+            }
+        }
+
+        /* readahead() and fadvise() may leave IO in flight, thus the
+            final residency is measured by the separate pass after all.
+            Skipped files are left out, they aren't in the target.   */
+
+        resident = 0;
+
+        TProbe probe;
+
+        for (size_t z = 0; z < items.size(); z++) {
+            if (!warmed[z]) continue;
+
+            try {
+                NOs::TFile file(Resolve(items[z], cfg));
+
+                resident += Measure(file, items[z], cfg, probe);
+            } catch (TError &error) {
+                /* gone since warming, none of it is resident */
+            }
+        }
+
+        Report(items.size(), "final");
+
+        return 0;
+    }
+
+protected:
+    std::string Resolve(const NSnap::TItem &item, const TCfg &cfg) const
+    {
+        std::string path(item.Path);
+
+        if (!cfg.Base.empty() && (path.empty() || path[0] != '/'))
+            path = cfg.Base + "/" + path;
+
+        return path;
+    }
+
+    /* Skipped file takes its share out of the target, false is
+        returned for it and the final pass doesn't measure it     */
+
+    bool Warm(const NSnap::TItem &item, const TCfg &cfg, TThrottle &throttle,
+                TProbe &probe)
+    {
+        const std::string path = Resolve(item, cfg);
+
+        uint64_t share = Pages(item, NMisc::DivUp(item.Rec->Size, page)) * page;
+
+        try {
+            NOs::TFile file(path);
+
+            const NOs::TStat info(file);
+
+            if (info.Loc.Dev != item.Loc().Dev || info.Loc.Ino != item.Loc().Ino)
+                throw TError("is replaced since snapshot");
+
+            /* pages past the end of a truncated file can't be cached */
+
+            if (info.Bytes < item.Rec->Size) {
+                const uint64_t left = Pages(item, NMisc::DivUp(info.Bytes, page)) * page;
+
+                target -= share - left, share = left;
+            }
+
+            for (auto &range : Coalesce(item, cfg)) {
+                NUtils::TSpan span(range.At * page, range.Pages * page);
+
+                while (span) {
+                    const size_t at = span.at;
+                    const size_t bytes = span.advance(cfg.Piece);
+
+                    throttle.Take(bytes);
+
+                    if (cfg.Fadvise) {
+                        if (::posix_fadvise(file, at, bytes, POSIX_FADV_WILLNEED) != 0)
+                            throw TError("failed to invoke fadvise() on file");
+                    } else if (::readahead(file, at, bytes) < 0) {
+                        throw TError("failed to invoke readahead() on file");
+                    }
+
+                    issued += bytes;
+                }
+            }
+
+            resident += Measure(file, item, cfg, probe);
+
+        } catch (TError &error) {
+            target -= share;
+
+            Skip(path, error.what());
+
+            return false;
+        }
+
+        return true;
+    }
+
+    /* Pages of runs of the item below the limit page */
+
+    static uint64_t Pages(const NSnap::TItem &item, uint64_t last)
+    {
+        uint64_t pages = 0;
+
+        for (auto runs = item.Runs(); runs;) {
+            const TRun run = runs.next();
+
+            if (run.At >= last) break;
+
+            pages += std::min(run.After(), last) - run.At;
+        }
+
+        return pages;
+    }
+
+    /* Joins runs of the item which are closer than the gap */
+
+    std::vector<TRun> Coalesce(const NSnap::TItem &item, const TCfg &cfg) const
+    {
+        std::vector<TRun> ranges;
+
+        const uint64_t gap = cfg.Gap / page;
+        const uint64_t last = NMisc::DivUp(item.Rec->Size, page);
+
+        for (auto runs = item.Runs(); runs;) {
+            TRun run = runs.next();
+
+            if (run.At >= last) break;
+
+            run.Pages = std::min(run.After(), last) - run.At;
+
+            if (!ranges.empty() && ranges.back().After() + gap >= run.At) {
+                ranges.back().Pages = run.After() - ranges.back().At;
+            } else {
+                ranges.push_back(run);
+            }
+        }
+
+        return ranges;
+    }
+
+    /* Cached bytes of the target runs, coalesced ranges are probed
+        and resulting spans are intersected with the original runs */
+
+    uint64_t Measure(const NOs::TFile &file, const NSnap::TItem &item,
+                        const TCfg &cfg, TProbe &probe) const
+    {
+        std::vector<TRun> runs;
+
+        for (auto it = item.Runs(); it;) runs.push_back(it.next());
+
+        uint64_t bytes = 0;
+        size_t near = 0;
+
+        const uint64_t size = NOs::TStat(file).Bytes;
+
+        for (auto &range : Coalesce(item, cfg)) {
+            const NUtils::TSpan span(range.At * page, range.Pages * page);
+
+            if (span.at >= size) break;
+
+            probe(file, NUtils::TSpan(span.at, std::min(span.bytes, size - span.at)),
+                [&](NUtils::TSpan &got) {
+                    const uint64_t at = got.at / page, end = got.after() / page;
+
+                    while (near < runs.size() && runs[near].After() <= at) near++;
+
+                    for (size_t z = near; z < runs.size() && runs[z].At < end; z++) {
+                        const uint64_t from = std::max(at, runs[z].At);
+                        const uint64_t to = std::min(end, runs[z].After());
+
+                        if (from < to) bytes += (to - from) * page;
+                    }
+                });
+        }
+
+        return bytes;
+    }
+
+    void Skip(const std::string &path, const char *why)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+
+        std::cerr << "skip " << path << " " << why << "\n";
+
+        skipped++;
+    }
+
+    void Report(size_t total, const char *what) const
+    {
+        const double share = target > 0 ? 100. * resident / target : 100.;
+
+        std::cerr
+            << what << " " << done << " of " << total << " files"
+            << ", issued " << NHumans::Value(issued)
+            << ", resident " << NHumans::Value(resident)
+            << " of " << NHumans::Value(target)
+            << " " << std::fixed << std::setprecision(1) << share << "%"
+            << ", skipped " << skipped << "\n";
+    }
+
+    size_t                  page    = 0;
+    size_t                  done    = 0;
+    size_t                  skipped = 0;
+    std::atomic<uint64_t>   target{ 0 };
+    std::atomic<uint64_t>   issued{ 0 };
+    std::atomic<uint64_t>   resident{ 0 };
+    std::mutex              lock;
+    std::condition_variable wake;
+};